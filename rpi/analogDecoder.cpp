@@ -4,17 +4,31 @@
 #include <algorithm>
 #include <iostream>
 
-#define HW_RATIO 17
-
 #define MIN_OOK_THRESHOLD 0.25f
 #define OOK_THRESHOLD_RATIO 0.75f
 #define OOK_DECAY_PER_SAMPLE 0.0001f
 
 #define FILTER_ALPHA 0.7
 
+void AnalogDecoder::setSampleIndex(uint64_t index)
+{
+    m_sampleIndex = index;
+    m_discardedSamples = index % HW_RATIO;
+}
+
+uint64_t AnalogDecoder::settlingSamples()
+{
+    //
+    // The slowest state is the peak tracker decaying from full scale to the floor.
+    //
+    const float floor = MIN_OOK_THRESHOLD/OOK_THRESHOLD_RATIO;
+    return (uint64_t)((1.0f - floor)/OOK_DECAY_PER_SAMPLE + 1) * HW_RATIO;
+}
 
 void AnalogDecoder::handleMagnitude(float val)
 {
+    const uint64_t sampleIndex = m_sampleIndex++;
+    
     //
     // Smooth
     //
@@ -45,20 +59,48 @@ void AnalogDecoder::handleMagnitude(float val)
     m_ookMax = std::max(m_ookMax, MIN_OOK_THRESHOLD/OOK_THRESHOLD_RATIO);
 
     //
-    // Send to digital stage
+    // Send to digital stage, with the margin so later stages can weigh the decision
     //
-    int digital;
     if(m_cb)
     {
-        if(val > m_ookMax*OOK_THRESHOLD_RATIO)
-        {
-            digital = 1;
-            m_cb(1);
-        }
-        else
+        const float margin = val - m_ookMax*OOK_THRESHOLD_RATIO;
+        m_cb((margin > 0.0f) ? 1 : 0, sampleIndex, margin);
+    }
+}
+
+const float *AnalogDecoder::magnitudeLut()
+{
+    //
+    // One entry per (I, Q) byte pair, built on first use.
+    //
+    static float *lut = []()
+    {
+        static float table[0x10000];
+        
+        for(uint32_t ii = 0; ii < 0x10000; ++ii)
         {
-            digital = 0;
-            m_cb(0);
+            uint8_t real_i = ii & 0xFF;
+            uint8_t imag_i = ii >> 8;
+            
+            float real = (((float)real_i) - 127.4) * (1.0f/128.0f);
+            float imag = (((float)imag_i) - 127.4) * (1.0f/128.0f);
+            
+            table[ii] = std::sqrt(real*real + imag*imag);
         }
+        
+        return table;
+    }();
+    
+    return lut;
+}
+
+void AnalogDecoder::handleSamples(const unsigned char *buf, uint32_t len)
+{
+    const float *lut = magnitudeLut();
+    
+    int n_samples = len/2;
+    for(int i = 0; i < n_samples; ++i)
+    {
+        handleMagnitude(lut[buf[i*2] | (buf[i*2 + 1] << 8)]);
     }
 }
@@ -1,6 +1,7 @@
 #ifndef __ANALOG_DECODER_H__
 #define __ANALOG_DECODER_H__
 
+#include <stdint.h>
 #include <functional>
 
 class AnalogDecoder
@@ -9,11 +10,32 @@ class AnalogDecoder
     AnalogDecoder() = default;
     
     void handleMagnitude(float value);
-    void setCallback(std::function<void(char)> cb) {m_cb = cb;};
+    
+    // Raw 8-bit interleaved IQ as delivered by librtlsdr
+    void handleSamples(const unsigned char *buf, uint32_t len);
+    
+    // Called with each sliced sample, the absolute index of the raw sample it came from,
+    // and how far above (+) or below (-) the threshold it was
+    void setCallback(std::function<void(char, uint64_t, float)> cb) {m_cb = cb;};
+    
+    // Raw samples seen so far, i.e. the index of the next one
+    uint64_t getSampleIndex() const {return m_sampleIndex;};
+    
+    // Start part way into a stream, decimating in step with a decoder that began at 0
+    void setSampleIndex(uint64_t index);
+    
+    // Raw samples after which the adaptive threshold no longer depends on where we started
+    static uint64_t settlingSamples();
+    
+    // Raw samples per sliced sample
+    static const unsigned int HW_RATIO = 17;
     
   private:
-    std::function<void(char)> m_cb;
+    static const float *magnitudeLut();
+    
+    std::function<void(char, uint64_t, float)> m_cb;
     
+    uint64_t m_sampleIndex = 0;
     int m_discardedSamples = 0;
     float m_ookMax = 0.0;
     float m_val = 0.0;
@@ -0,0 +1,184 @@
+#include "burstArchive.h"
+#include "digitalDecoder.h"
+#include "analogDecoder.h"
+#include "protocolRegistry.h"
+#include "sampleClock.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//
+// Builds burst archives from raw captures, lists them, and replays any time
+// interval of one through the decoder.
+//
+
+#define SAMPLE_RATE (1000000)
+
+// Margins kept either side of a burst; must match what main.cpp records with
+#define ARCHIVE_PRE_SECONDS  (0.05f)
+#define ARCHIVE_POST_SECONDS (0.05f)
+
+// Samples handed to the writer/decoder per call, like one USB buffer
+#define BLOCK_SAMPLES (128*1024)
+
+static void usage(const char *name)
+{
+    printf("Usage: %s -c [options] <capture.cu8> <archive>   Archive the bursts in a raw capture\n", name);
+    printf("       %s -l <archive>                         List the bursts\n", name);
+    printf("       %s -p [options] <archive>               Replay bursts through the decoder\n", name);
+    printf("  -r <rate>   Capture sample rate (default %d)\n", SAMPLE_RATE);
+    printf("  -T <epoch>  Wall time of the capture's first sample, in seconds (default 0)\n");
+    printf("  -d          Delta code before deflating\n");
+    printf("  -Z          Don't deflate\n");
+    printf("  -s <epoch>  Replay from this time\n");
+    printf("  -e <epoch>  Replay up to this time\n");
+}
+
+static int convert(const char *capturePath, const char *archivePath, uint32_t sampleRate, double startTime, uint32_t coding)
+{
+    FILE *in = fopen(capturePath, "rb");
+    if(!in)
+    {
+        perror(capturePath);
+        return -1;
+    }
+
+    SampleClock clock(sampleRate);
+    clock.setAnchor(0, (int64_t)(startTime*1e6), 0);
+
+    std::vector<unsigned char> buf(2*BLOCK_SAMPLES);
+    uint64_t rawBytes = 0;
+
+    {
+        BurstArchiveWriter writer(archivePath, sampleRate, ARCHIVE_PRE_SECONDS, ARCHIVE_POST_SECONDS, coding, &clock);
+        writer.setBlocking(true);
+
+        size_t got;
+        while((got = fread(buf.data(), 1, buf.size(), in)) > 0)
+        {
+            writer.push(buf.data(), got);
+            rawBytes += got;
+        }
+    }
+
+    fclose(in);
+
+    struct stat st;
+    if(stat(archivePath, &st) != 0)
+    {
+        perror(archivePath);
+        return -1;
+    }
+
+    BurstArchiveReader reader(archivePath);
+    printf("%llu bytes -> %llu bytes (%.1fx), %zu bursts\n",
+        (unsigned long long)rawBytes, (unsigned long long)st.st_size,
+        st.st_size ? (double)rawBytes/st.st_size : 0.0, reader.getBursts().size());
+    return 0;
+}
+
+static int list(const BurstArchiveReader &reader)
+{
+    printf("%8s %14s %20s %10s %10s\n", "Burst", "StartSample", "Time", "Samples", "Bytes");
+
+    const auto &bursts = reader.getBursts();
+    for(size_t ii = 0; ii < bursts.size(); ++ii)
+    {
+        printf("%8zu %14llu %13lld.%06lld %10u %10u\n", ii,
+            (unsigned long long)bursts[ii].startSample,
+            (long long)(bursts[ii].realtimeUs/1000000), (long long)(bursts[ii].realtimeUs%1000000),
+            bursts[ii].sampleCount, bursts[ii].codedBytes);
+    }
+    return 0;
+}
+
+static int replay(const BurstArchiveReader &reader, int64_t fromUs, int64_t toUs)
+{
+    //
+    // Each burst gets a fresh analog stage and framer, as its lead-in is silence;
+    // device state carries across bursts as it would live.
+    //
+    SampleClock clock(reader.getSampleRate());
+    DigitalDecoder dDecoder;
+    dDecoder.setOutputEnabled(false);
+    dDecoder.setSampleClock(&clock);
+
+    const auto &bursts = reader.getBursts();
+    std::vector<unsigned char> iq;
+
+    for(size_t ii = reader.findTime(fromUs); ii < bursts.size() && bursts[ii].realtimeUs < toUs; ++ii)
+    {
+        if(!reader.read(ii, iq))
+        {
+            fprintf(stderr, "Burst %zu is corrupt, skipping\n", ii);
+            continue;
+        }
+
+        clock.setAnchor(bursts[ii].startSample, bursts[ii].realtimeUs, 0);
+
+        AnalogDecoder aDecoder;
+        ProtocolRegistry protocols;
+        dDecoder.registerProtocols(protocols);
+
+        aDecoder.setSampleIndex(bursts[ii].startSample);
+        aDecoder.setCallback([&](char data, uint64_t sampleIndex, float margin){protocols.handleData(data, sampleIndex, margin);});
+        dDecoder.setPayloadCallback([&](uint64_t payload, bool valid, uint64_t sampleIndex)
+        {
+            if(valid) DigitalDecoder::writeFrameLog(stdout, payload, sampleIndex, clock);
+        });
+
+        for(size_t ss = 0; ss < iq.size(); ss += 2*BLOCK_SAMPLES)
+        {
+            aDecoder.handleSamples(&iq[ss], std::min<size_t>(2*BLOCK_SAMPLES, iq.size() - ss));
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    char mode = 0;
+    uint32_t sampleRate = SAMPLE_RATE;
+    double startTime = 0.0;
+    int64_t fromUs = INT64_MIN;
+    int64_t toUs = INT64_MAX;
+    uint32_t coding = ARCHIVE_ZLIB;
+
+    int opt;
+    while((opt = getopt(argc, argv, "clpr:T:dZs:e:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 'c':
+            case 'l':
+            case 'p': mode = opt; break;
+            case 'r': sampleRate = atoi(optarg); break;
+            case 'T': startTime = atof(optarg); break;
+            case 'd': coding |= ARCHIVE_DELTA; break;
+            case 'Z': coding &= ~ARCHIVE_ZLIB; break;
+            case 's': fromUs = (int64_t)(atof(optarg)*1e6); break;
+            case 'e': toUs = (int64_t)(atof(optarg)*1e6); break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+
+    if(mode == 'c' && optind == argc - 2 && sampleRate > 0)
+    {
+        return convert(argv[optind], argv[optind + 1], sampleRate, startTime, coding);
+    }
+
+    if((mode != 'l' && mode != 'p') || optind != argc - 1)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    BurstArchiveReader reader(argv[optind]);
+    if(!reader.isOpen()) return -1;
+
+    return (mode == 'l') ? list(reader) : replay(reader, fromUs, toUs);
+}
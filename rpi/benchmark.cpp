@@ -0,0 +1,187 @@
+#include "digitalDecoder.h"
+#include "analogDecoder.h"
+#include "protocolRegistry.h"
+#include "signalGenerator.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <vector>
+
+//
+// Sweeps SNR over synthetic transmissions and reports how many frames the
+// AnalogDecoder/DigitalDecoder chain recovers and how fast it runs.
+//
+
+#define DEFAULT_EVENTS  (200)
+#define DEFAULT_REPEATS (4)
+#define DEFAULT_GAP_CHIPS (40)
+
+//
+// Serial/status pairs whose payload has the sync word in its data. They lead
+// every sweep, so framing that resyncs on them shows up as lost events.
+//
+static const struct
+{
+    uint32_t serial;
+    uint8_t status;
+} SYNC_IN_DATA_EVENTS[] =
+{
+    {511, 0xFC},    // FFFE8001FFFC802F
+    {1023, 0xF8}
+};
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  -s <dB>    Lowest SNR (default 0)\n");
+    printf("  -S <dB>    Highest SNR (default 20)\n");
+    printf("  -t <dB>    SNR step (default 2)\n");
+    printf("  -n <count> Events per SNR point (default %d)\n", DEFAULT_EVENTS);
+    printf("  -r <count> Frames per event (default %d)\n", DEFAULT_REPEATS);
+    printf("  -b <count> Events sent back to back, as from neighbouring sensors (default 1)\n");
+    printf("  -g <chips> Gap between frames of an event (default %d)\n", DEFAULT_GAP_CHIPS);
+    printf("  -f <Hz>    Carrier frequency offset (default 0)\n");
+    printf("  -d <ppm>   Transmitter clock drift (default 0)\n");
+    printf("  -i <duty>  Interferer duty cycle, 0-1 (default 0)\n");
+    printf("  -a <amp>   Interferer amplitude (default 0.5)\n");
+    printf("  -H         Hard decisions only, no combining of failed repeats\n");
+    printf("  -w <file>  Also write the last SNR point's IQ to a capture, e.g. for offlineDecoder -V\n");
+}
+
+int main(int argc, char **argv)
+{
+    float snrMin = 0.0f;
+    float snrMax = 20.0f;
+    float snrStep = 2.0f;
+    int events = DEFAULT_EVENTS;
+    int repeats = DEFAULT_REPEATS;
+    int backToBack = 1;
+    int gapChips = DEFAULT_GAP_CHIPS;
+    bool combining = true;
+    const char *capturePath = nullptr;
+
+    SignalGenerator::config_t config;
+    config.interfererAmplitude = 0.5f;
+
+    int opt;
+    while((opt = getopt(argc, argv, "s:S:t:n:r:b:g:f:d:i:a:Hw:h")) != -1)
+    {
+        switch(opt)
+        {
+            case 's': snrMin = atof(optarg); break;
+            case 'S': snrMax = atof(optarg); break;
+            case 't': snrStep = atof(optarg); break;
+            case 'n': events = atoi(optarg); break;
+            case 'r': repeats = atoi(optarg); break;
+            case 'b': backToBack = atoi(optarg); break;
+            case 'g': gapChips = atoi(optarg); break;
+            case 'f': config.freqOffsetHz = atof(optarg); break;
+            case 'd': config.clockDriftPpm = atof(optarg); break;
+            case 'i': config.interfererDuty = atof(optarg); break;
+            case 'a': config.interfererAmplitude = atof(optarg); break;
+            case 'H': combining = false; break;
+            case 'w': capturePath = optarg; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+
+    if(snrStep <= 0.0f || events < 1 || repeats < 1 || backToBack < 1 || gapChips < 0)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    printf("%8s %8s %8s %8s %8s %8s %10s %10s\n", "SNR(dB)", "Frames", "Decoded", "Frame%", "Combined", "Event%", "MSamp/s", "xRealtime");
+
+    for(float snr = snrMin; snr <= snrMax + 1e-3f; snr += snrStep)
+    {
+        config.snrDb = snr;
+        SignalGenerator generator(config, 1234);
+
+        //
+        // Each event gets its own serial so we can tell which ones made it through.
+        //
+        std::vector<unsigned char> iq;
+        std::vector<uint64_t> frames;
+
+        generator.addSilence(iq, config.sampleRate/10);
+        for(int ee = 0; ee < events; ++ee)
+        {
+            uint64_t frame = SignalGenerator::buildFrame(100000 + ee, (ee & 1) ? 0x80 : 0x00);
+            if(ee < (int)(sizeof(SYNC_IN_DATA_EVENTS)/sizeof(SYNC_IN_DATA_EVENTS[0])))
+            {
+                frame = SignalGenerator::buildFrame(SYNC_IN_DATA_EVENTS[ee].serial, SYNC_IN_DATA_EVENTS[ee].status);
+            }
+            frames.push_back(frame);
+            generator.addBurst(iq, frame, repeats, gapChips);
+            if((ee + 1) % backToBack == 0) generator.addSilence(iq, config.sampleRate/20);
+        }
+
+        if(capturePath)
+        {
+            FILE *capture = fopen(capturePath, "wb");
+            if(!capture || fwrite(iq.data(), 1, iq.size(), capture) != iq.size())
+            {
+                perror(capturePath);
+                return -1;
+            }
+            fclose(capture);
+        }
+
+        AnalogDecoder aDecoder;
+        DigitalDecoder dDecoder;
+        ProtocolRegistry protocols;
+        dDecoder.registerProtocols(protocols);
+        dDecoder.setOutputEnabled(false);
+        protocols.setCombining(combining);
+
+        uint32_t decoded = 0;
+        uint32_t combined = 0;
+        uint32_t recoveredSeen = 0;
+        uint32_t eventsDecoded = 0;
+        size_t nextEvent = 0;
+        size_t lastEvent = frames.size();
+
+        aDecoder.setCallback([&](char data, uint64_t sampleIndex, float margin){protocols.handleData(data, sampleIndex, margin);});
+        dDecoder.setPayloadCallback([&](uint64_t payload, bool valid, uint64_t)
+        {
+            if(!valid) return;
+
+            // The registry counts a recovery just before reporting it
+            const bool recovered = (protocols.getRecoveredCount() != recoveredSeen);
+            recoveredSeen = protocols.getRecoveredCount();
+
+            // Frames arrive in order, so only look ahead from the last match
+            for(size_t ii = nextEvent; ii < frames.size(); ++ii)
+            {
+                if(frames[ii] == payload)
+                {
+                    // Frames recovered by combining failed copies count toward events, not frames
+                    if(recovered) combined++;
+                    else decoded++;
+                    if(ii != lastEvent) eventsDecoded++;
+                    lastEvent = ii;
+                    nextEvent = ii;
+                    break;
+                }
+            }
+        });
+
+        const auto start = std::chrono::steady_clock::now();
+        aDecoder.handleSamples(iq.data(), iq.size());
+        const auto stop = std::chrono::steady_clock::now();
+
+        const double seconds = std::chrono::duration<double>(stop - start).count();
+        const double samples = iq.size()/2;
+        const uint32_t sent = events*repeats;
+
+        printf("%8.1f %8u %8u %8.1f %8u %8.1f %10.2f %10.1f\n",
+            snr, sent, decoded,
+            100.0*decoded/sent, combined, 100.0*eventsDecoded/events,
+            samples/seconds/1e6, samples/config.sampleRate/seconds);
+    }
+
+    return 0;
+}
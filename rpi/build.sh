@@ -1,2 +1,6 @@
 #!/bin/sh
-g++ -o honeywell --std=c++11 digitalDecoder.cpp analogDecoder.cpp main.cpp -lrtlsdr
+g++ -o honeywell --std=c++11 -D_FILE_OFFSET_BITS=64 digitalDecoder.cpp analogDecoder.cpp protocolRegistry.cpp eventSerializer.cpp outputSink.cpp sampleClock.cpp iqRingBuffer.cpp burstArchive.cpp main.cpp -lrtlsdr -pthread -lz
+g++ -o benchmark --std=c++11 -D_FILE_OFFSET_BITS=64 -O2 digitalDecoder.cpp analogDecoder.cpp protocolRegistry.cpp eventSerializer.cpp outputSink.cpp sampleClock.cpp signalGenerator.cpp benchmark.cpp
+g++ -o loadGenerator --std=c++11 -D_FILE_OFFSET_BITS=64 -O2 digitalDecoder.cpp protocolRegistry.cpp eventSerializer.cpp outputSink.cpp sampleClock.cpp signalGenerator.cpp loadGenerator.cpp -pthread
+g++ -o offlineDecoder --std=c++11 -D_FILE_OFFSET_BITS=64 -O2 digitalDecoder.cpp analogDecoder.cpp protocolRegistry.cpp eventSerializer.cpp outputSink.cpp sampleClock.cpp offlineDecoder.cpp -pthread
+g++ -o archiveTool --std=c++11 -D_FILE_OFFSET_BITS=64 -O2 digitalDecoder.cpp analogDecoder.cpp protocolRegistry.cpp eventSerializer.cpp outputSink.cpp sampleClock.cpp burstArchive.cpp archiveTool.cpp -pthread -lz
@@ -0,0 +1,488 @@
+#include "burstArchive.h"
+#include "sampleClock.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <zlib.h>
+
+#define ARCHIVE_VERSION (1)
+
+static const char FILE_MAGIC[4] = {'H', 'W', 'B', 'A'};
+static const char BURST_MAGIC[4] = {'B', 'R', 'S', 'T'};
+static const char INDEX_MAGIC[4] = {'H', 'W', 'I', 'X'};
+
+// Detection works on blocks of this many samples
+#define BLOCK_SAMPLES (256)
+
+// A block is signal if its mean power is this far above the noise floor (3 dB)
+#define ACTIVE_RATIO (2.0f)
+
+// The floor follows quieter blocks at once and louder ones slowly (x2 in ~700 ms)
+#define FLOOR_RISE (1.0f/4096.0f)
+#define MIN_NOISE_FLOOR (1.0f)
+
+// Split anything longer, e.g. a stuck interferer, into records of this size (about 1 s)
+#define MAX_BURST_SAMPLES (1024*1024)
+
+#define WRITER_POLL_MS (100)
+
+//
+// On-disk layout (little endian):
+//   archiveHeader_t
+//   archiveBurst_t + coded samples, repeated
+//   archiveIndex_t * count, archiveTrailer_t      (written on close)
+//
+struct archiveHeader_t
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t sampleRate;
+    uint32_t coding;
+};
+
+struct archiveBurst_t
+{
+    char magic[4];
+    uint32_t coding;        // May differ from the file's if deflate didn't help
+    uint64_t startSample;
+    int64_t realtimeUs;
+    uint32_t sampleCount;
+    uint32_t codedBytes;
+};
+
+struct archiveTrailer_t
+{
+    char magic[4];
+    uint32_t count;
+    uint64_t indexOffset;
+};
+
+//
+// Delta coding helps when the front end leaves slow drift or a strong carrier
+// in the samples; on white receiver noise it gains nothing, so it's optional.
+//
+static void deltaEncode(unsigned char *iq, size_t len)
+{
+    for(size_t ii = len; ii-- > 2;)
+    {
+        iq[ii] -= iq[ii - 2];
+    }
+}
+
+static void deltaDecode(std::vector<unsigned char> &iq)
+{
+    for(size_t ii = 2; ii < iq.size(); ++ii)
+    {
+        iq[ii] += iq[ii - 2];
+    }
+}
+
+BurstArchiveWriter::BurstArchiveWriter(const std::string &path, uint32_t sampleRate, float preSeconds, float postSeconds,
+                                       uint32_t coding, const SampleClock *clock) :
+    m_coding(coding),
+    m_clock(clock)
+{
+    // Two bytes (I and Q) per sample
+    m_preBytes = 2*(uint64_t)(preSeconds*sampleRate);
+    m_postSamples = (uint64_t)(postSeconds*sampleRate);
+    m_block.resize(2*BLOCK_SAMPLES);
+    m_pre.resize(std::max<uint64_t>(m_preBytes, 2));
+
+    // Lead-in, then blocks until the record is full; the last block may run past it
+    const size_t capacity = m_preBytes + 2*(uint64_t)MAX_BURST_SAMPLES + m_block.size();
+    for(auto &buffer : m_buffers)
+    {
+        buffer.iq.resize(capacity);
+    }
+    m_deflated.resize((m_coding & ARCHIVE_ZLIB) ? compressBound(capacity) : 0);
+
+    m_fp = fopen(path.c_str(), "wb");
+    if(!m_fp)
+    {
+        std::cout << "Failed to open " << path << " for IQ archive" << std::endl;
+        return;
+    }
+
+    archiveHeader_t header;
+    memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.sampleRate = sampleRate;
+    header.coding = coding;
+
+    fwrite(&header, sizeof(header), 1, m_fp);
+    m_fileOffset = sizeof(header);
+
+    m_writer = std::thread(&BurstArchiveWriter::writerLoop, this);
+}
+
+BurstArchiveWriter::~BurstArchiveWriter()
+{
+    close();
+}
+
+void BurstArchiveWriter::push(const unsigned char *buf, uint32_t len)
+{
+    if(!m_fp) return;
+
+    while(len > 0)
+    {
+        const size_t take = std::min<size_t>(len, m_block.size() - m_blockFill);
+        memcpy(&m_block[m_blockFill], buf, take);
+
+        m_blockFill += take;
+        buf += take;
+        len -= take;
+
+        if(m_blockFill == m_block.size())
+        {
+            handleBlock();
+            m_blockFill = 0;
+        }
+    }
+}
+
+void BurstArchiveWriter::handleBlock()
+{
+    float power = 0.0f;
+    for(size_t ii = 0; ii < m_block.size(); ++ii)
+    {
+        const float val = m_block[ii] - 127.4f;
+        power += val*val;
+    }
+    power /= BLOCK_SAMPLES;
+
+    if(m_noiseFloor == 0.0f) m_noiseFloor = std::max(power, MIN_NOISE_FLOOR);
+
+    const bool active = power > m_noiseFloor*ACTIVE_RATIO;
+
+    if(power < m_noiseFloor) m_noiseFloor = std::max(power, MIN_NOISE_FLOOR);
+    else m_noiseFloor += m_noiseFloor*FLOOR_RISE;
+
+    m_sampleIndex += BLOCK_SAMPLES;
+
+    if(!m_inBurst)
+    {
+        if(active)
+        {
+            openBurst();
+            appendBurst(m_block.data(), m_block.size());
+            m_lastActive = m_sampleIndex;
+            return;
+        }
+
+        //
+        // Keep the most recent quiet samples as the lead-in for the next burst.
+        //
+        for(size_t ii = 0; ii < m_block.size(); ++ii)
+        {
+            m_pre[(m_preCount + ii) % m_pre.size()] = m_block[ii];
+        }
+        m_preCount += m_block.size();
+        return;
+    }
+
+    appendBurst(m_block.data(), m_block.size());
+    if(active) m_lastActive = m_sampleIndex;
+
+    const size_t bytes = m_burstDropped ? 0 : m_buffers[m_bufferHead.load(std::memory_order_relaxed) % BURST_BUFFERS].bytes;
+    if(m_sampleIndex - m_lastActive >= m_postSamples || bytes >= 2*(uint64_t)MAX_BURST_SAMPLES)
+    {
+        closeBurst();
+    }
+}
+
+void BurstArchiveWriter::openBurst()
+{
+    const uint64_t preBytes = std::min<uint64_t>(m_preCount, m_preBytes);
+    const uint64_t blockStart = m_sampleIndex - BLOCK_SAMPLES;
+
+    m_inBurst = true;
+
+    //
+    // Every buffer still waiting for the writer: lose this burst rather than block.
+    //
+    const uint32_t head = m_bufferHead.load(std::memory_order_relaxed);
+    if(m_blocking)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_drained.wait(lock, [&](){return head - m_bufferTail.load(std::memory_order_acquire) < BURST_BUFFERS;});
+    }
+
+    m_burstDropped = (head - m_bufferTail.load(std::memory_order_acquire) >= BURST_BUFFERS);
+    if(m_burstDropped)
+    {
+        m_droppedBursts++;
+        return;
+    }
+
+    burstBuffer_t &burst = m_buffers[head % BURST_BUFFERS];
+    burst.startSample = blockStart - preBytes/2;
+    burst.realtimeUs = m_clock ? m_clock->toRealtimeUs(burst.startSample) : 0;
+    burst.bytes = 0;
+
+    // The lead-in ring may wrap, so copy it in up to two pieces
+    const uint64_t first = m_preCount - preBytes;
+    const size_t offset = first % m_pre.size();
+    const size_t firstLen = std::min<uint64_t>(preBytes, m_pre.size() - offset);
+    appendBurst(&m_pre[offset], firstLen);
+    appendBurst(&m_pre[0], preBytes - firstLen);
+}
+
+void BurstArchiveWriter::appendBurst(const unsigned char *data, size_t len)
+{
+    if(m_burstDropped) return;
+
+    burstBuffer_t &burst = m_buffers[m_bufferHead.load(std::memory_order_relaxed) % BURST_BUFFERS];
+    memcpy(&burst.iq[burst.bytes], data, len);
+    burst.bytes += len;
+}
+
+void BurstArchiveWriter::closeBurst()
+{
+    if(!m_burstDropped)
+    {
+        m_bufferHead.store(m_bufferHead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        m_wake.notify_one();
+    }
+
+    // The post margin already holds these samples; don't record them twice
+    m_inBurst = false;
+    m_preCount = 0;
+}
+
+void BurstArchiveWriter::close()
+{
+    if(!m_fp) return;
+
+    if(m_inBurst) closeBurst();
+
+    m_running = false;
+    m_wake.notify_one();
+    m_writer.join();
+
+    if(m_droppedBursts > 0)
+    {
+        std::cout << "IQ archive writer fell behind, " << m_droppedBursts << " bursts were not recorded" << std::endl;
+    }
+
+    //
+    // Index and trailer; without them the reader falls back to walking the records.
+    //
+    archiveTrailer_t trailer;
+    memcpy(trailer.magic, INDEX_MAGIC, sizeof(trailer.magic));
+    trailer.count = m_index.size();
+    trailer.indexOffset = m_fileOffset;
+
+    if(!m_index.empty()) fwrite(m_index.data(), sizeof(archiveIndex_t), m_index.size(), m_fp);
+    fwrite(&trailer, sizeof(trailer), 1, m_fp);
+    fclose(m_fp);
+    m_fp = nullptr;
+}
+
+void BurstArchiveWriter::writerLoop()
+{
+    bool running = true;
+
+    while(running)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait_for(lock, std::chrono::milliseconds(WRITER_POLL_MS));
+        }
+
+        // Take one last pass on shutdown so the final burst is written
+        running = m_running;
+
+        uint32_t tail = m_bufferTail.load(std::memory_order_relaxed);
+        while(tail != m_bufferHead.load(std::memory_order_acquire))
+        {
+            writeBurst(m_buffers[tail % BURST_BUFFERS]);
+
+            tail++;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_bufferTail.store(tail, std::memory_order_release);
+            }
+            m_drained.notify_one();
+        }
+    }
+}
+
+void BurstArchiveWriter::writeBurst(burstBuffer_t &burst)
+{
+    archiveBurst_t header;
+    memcpy(header.magic, BURST_MAGIC, sizeof(header.magic));
+    header.coding = 0;
+    header.startSample = burst.startSample;
+    header.realtimeUs = burst.realtimeUs;
+    header.sampleCount = burst.bytes/2;
+
+    if(m_coding & ARCHIVE_DELTA)
+    {
+        deltaEncode(burst.iq.data(), burst.bytes);
+        header.coding |= ARCHIVE_DELTA;
+    }
+
+    const unsigned char *data = burst.iq.data();
+    uLongf codedBytes = burst.bytes;
+
+    if(m_coding & ARCHIVE_ZLIB)
+    {
+        uLongf deflatedBytes = m_deflated.size();
+
+        // Keep the record as it is if deflate didn't shrink it
+        if(compress2(m_deflated.data(), &deflatedBytes, burst.iq.data(), burst.bytes, Z_DEFAULT_COMPRESSION) == Z_OK &&
+           deflatedBytes < codedBytes)
+        {
+            data = m_deflated.data();
+            codedBytes = deflatedBytes;
+            header.coding |= ARCHIVE_ZLIB;
+        }
+    }
+
+    header.codedBytes = codedBytes;
+
+    fwrite(&header, sizeof(header), 1, m_fp);
+    fwrite(data, 1, codedBytes, m_fp);
+
+    // A crash now loses at most the burst being written
+    fflush(m_fp);
+
+    archiveIndex_t entry;
+    entry.startSample = header.startSample;
+    entry.realtimeUs = header.realtimeUs;
+    entry.offset = m_fileOffset;
+    entry.sampleCount = header.sampleCount;
+    entry.codedBytes = header.codedBytes;
+    m_index.push_back(entry);
+
+    m_fileOffset += sizeof(header) + codedBytes;
+}
+
+BurstArchiveReader::BurstArchiveReader(const std::string &path)
+{
+    m_fp = fopen(path.c_str(), "rb");
+    if(!m_fp)
+    {
+        std::cout << "Failed to open " << path << std::endl;
+        return;
+    }
+
+    archiveHeader_t header;
+    if(fread(&header, sizeof(header), 1, m_fp) != 1 || memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 ||
+       header.version != ARCHIVE_VERSION)
+    {
+        std::cout << path << " is not an IQ archive" << std::endl;
+        fclose(m_fp);
+        m_fp = nullptr;
+        return;
+    }
+
+    m_sampleRate = header.sampleRate;
+
+    if(!readIndex())
+    {
+        std::cout << path << " has no index (recorder didn't exit cleanly?), rebuilding it" << std::endl;
+        scanRecords();
+    }
+}
+
+BurstArchiveReader::~BurstArchiveReader()
+{
+    if(m_fp) fclose(m_fp);
+}
+
+bool BurstArchiveReader::readIndex()
+{
+    archiveTrailer_t trailer;
+    if(fseeko(m_fp, -(off_t)sizeof(trailer), SEEK_END) != 0) return false;
+
+    const off_t trailerOffset = ftello(m_fp);
+    if(fread(&trailer, sizeof(trailer), 1, m_fp) != 1 || memcmp(trailer.magic, INDEX_MAGIC, sizeof(trailer.magic)) != 0) return false;
+    if(trailer.indexOffset + (uint64_t)trailer.count*sizeof(archiveIndex_t) != (uint64_t)trailerOffset) return false;
+
+    m_index.resize(trailer.count);
+    if(fseeko(m_fp, trailer.indexOffset, SEEK_SET) != 0) return false;
+    if(trailer.count > 0 && fread(m_index.data(), sizeof(archiveIndex_t), trailer.count, m_fp) != trailer.count)
+    {
+        m_index.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void BurstArchiveReader::scanRecords()
+{
+    m_index.clear();
+    uint64_t offset = sizeof(archiveHeader_t);
+    archiveBurst_t header;
+
+    while(fseeko(m_fp, offset, SEEK_SET) == 0 && fread(&header, sizeof(header), 1, m_fp) == 1 &&
+          memcmp(header.magic, BURST_MAGIC, sizeof(header.magic)) == 0)
+    {
+        archiveIndex_t entry;
+        entry.startSample = header.startSample;
+        entry.realtimeUs = header.realtimeUs;
+        entry.offset = offset;
+        entry.sampleCount = header.sampleCount;
+        entry.codedBytes = header.codedBytes;
+
+        offset += sizeof(header) + header.codedBytes;
+
+        // A record cut short by the crash
+        if(fseeko(m_fp, offset - 1, SEEK_SET) != 0 || fgetc(m_fp) == EOF) break;
+
+        m_index.push_back(entry);
+    }
+}
+
+size_t BurstArchiveReader::findSample(uint64_t sampleIndex) const
+{
+    return std::partition_point(m_index.begin(), m_index.end(), [&](const archiveIndex_t &entry)
+    {
+        return entry.startSample + entry.sampleCount <= sampleIndex;
+    }) - m_index.begin();
+}
+
+size_t BurstArchiveReader::findTime(int64_t realtimeUs) const
+{
+    return std::partition_point(m_index.begin(), m_index.end(), [&](const archiveIndex_t &entry)
+    {
+        return entry.realtimeUs + (int64_t)(entry.sampleCount*1000000ull/m_sampleRate) <= realtimeUs;
+    }) - m_index.begin();
+}
+
+bool BurstArchiveReader::read(size_t burst, std::vector<unsigned char> &iq) const
+{
+    if(!m_fp || burst >= m_index.size()) return false;
+
+    const archiveIndex_t &entry = m_index[burst];
+    archiveBurst_t header;
+
+    if(fseeko(m_fp, entry.offset, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, m_fp) != 1 ||
+       memcmp(header.magic, BURST_MAGIC, sizeof(header.magic)) != 0)
+    {
+        return false;
+    }
+
+    std::vector<unsigned char> coded(header.codedBytes);
+    if(header.codedBytes > 0 && fread(coded.data(), 1, coded.size(), m_fp) != coded.size()) return false;
+
+    if(header.coding & ARCHIVE_ZLIB)
+    {
+        iq.resize(2*(size_t)header.sampleCount);
+        uLongf rawBytes = iq.size();
+        if(uncompress(iq.data(), &rawBytes, coded.data(), coded.size()) != Z_OK || rawBytes != iq.size()) return false;
+    }
+    else
+    {
+        iq.swap(coded);
+    }
+
+    if(header.coding & ARCHIVE_DELTA) deltaDecode(iq);
+
+    return iq.size() == 2*(size_t)header.sampleCount;
+}
@@ -0,0 +1,140 @@
+#ifndef __BURST_ARCHIVE_H__
+#define __BURST_ARCHIVE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SampleClock;
+
+//
+// Compact long-term IQ recording. Only stretches of raw 8-bit IQ with signal
+// in them (plus a margin either side) are kept, each as one record that can
+// be delta coded and/or deflated. A time-sorted index at the end of the file
+// lets a reader seek straight to any interval.
+//
+
+enum ArchiveCoding
+{
+    ARCHIVE_DELTA = 0x01,   // Each byte minus the same component of the previous sample
+    ARCHIVE_ZLIB  = 0x02    // Deflate, applied after delta coding
+};
+
+struct archiveIndex_t
+{
+    uint64_t startSample;
+    int64_t realtimeUs;
+    uint64_t offset;        // Of the burst's record header
+    uint32_t sampleCount;
+    uint32_t codedBytes;
+};
+
+//
+// push() runs on the receive path and only detects bursts and copies samples into
+// a small pool of buffers allocated up front; it never allocates or locks. Coding
+// and file I/O happen on a background writer thread. If the writer falls so far
+// behind that no buffer is free, the burst is dropped rather than waited for.
+//
+class BurstArchiveWriter
+{
+  public:
+    BurstArchiveWriter(const std::string &path, uint32_t sampleRate, float preSeconds, float postSeconds,
+                       uint32_t coding, const SampleClock *clock = nullptr);
+    ~BurstArchiveWriter();
+
+    void push(const unsigned char *buf, uint32_t len);
+
+    // For offline tools: wait for the writer instead of dropping bursts. Not on the receive path.
+    void setBlocking(bool blocking) {m_blocking = blocking;};
+
+    // Flush any open burst and write the index; called by the destructor
+    void close();
+
+  private:
+    struct burstBuffer_t
+    {
+        uint64_t startSample;
+        int64_t realtimeUs;
+        size_t bytes;
+        std::vector<unsigned char> iq;      // Sized once for the longest record
+    };
+
+    static const uint32_t BURST_BUFFERS = 4;
+
+    void handleBlock();
+    void openBurst();
+    void appendBurst(const unsigned char *data, size_t len);
+    void closeBurst();
+    void writerLoop();
+    void writeBurst(burstBuffer_t &burst);
+
+    uint32_t m_coding;
+    const SampleClock *m_clock;
+    uint64_t m_preBytes;
+    uint64_t m_postSamples;
+
+    // Detection, one block at a time
+    std::vector<unsigned char> m_block;
+    size_t m_blockFill = 0;
+    uint64_t m_sampleIndex = 0;
+    float m_noiseFloor = 0.0f;
+
+    // Samples before the burst, as a ring
+    std::vector<unsigned char> m_pre;
+    uint64_t m_preCount = 0;
+
+    bool m_blocking = false;
+    bool m_inBurst = false;
+    bool m_burstDropped = false;
+    uint64_t m_lastActive = 0;
+    uint32_t m_droppedBursts = 0;
+
+    FILE *m_fp;
+    uint64_t m_fileOffset = 0;
+    std::vector<archiveIndex_t> m_index;
+    std::vector<unsigned char> m_deflated;
+
+    // Single producer (receive path) fills m_buffers[head], single consumer (writer thread) drains from tail
+    burstBuffer_t m_buffers[BURST_BUFFERS];
+    std::atomic<uint32_t> m_bufferHead{0};
+    std::atomic<uint32_t> m_bufferTail{0};
+
+    std::atomic<bool> m_running{true};
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_drained;
+    std::thread m_writer;
+};
+
+class BurstArchiveReader
+{
+  public:
+    explicit BurstArchiveReader(const std::string &path);
+    ~BurstArchiveReader();
+
+    bool isOpen() const {return m_fp != nullptr;};
+    uint32_t getSampleRate() const {return m_sampleRate;};
+    const std::vector<archiveIndex_t> &getBursts() const {return m_index;};
+
+    // First burst that ends after the given sample or time; size of getBursts() if none
+    size_t findSample(uint64_t sampleIndex) const;
+    size_t findTime(int64_t realtimeUs) const;
+
+    // Decode one burst back to raw 8-bit IQ
+    bool read(size_t burst, std::vector<unsigned char> &iq) const;
+
+  private:
+    bool readIndex();
+    void scanRecords();
+
+    FILE *m_fp = nullptr;
+    uint32_t m_sampleRate = 0;
+    std::vector<archiveIndex_t> m_index;
+};
+
+#endif
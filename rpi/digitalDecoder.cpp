@@ -1,16 +1,14 @@
 #include "digitalDecoder.h"
+#include "analogDecoder.h"
+#include "sampleClock.h"
 
 #include <iostream>
-#include <fstream>
 #include <string>
-#include <sstream>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
-#include <iomanip>
-#include <locale>
 #include <ctime>
 #include <csignal>
 
@@ -21,7 +19,12 @@
 #define SENSOR_TIMEOUT_MIN  (90*5)
 
 #define SYNC_MASK    0xFFFF000000000000ul
-#define SYNC_PATTERN 0xFFFE000000000000ul
+#define SYNC_BITS    16
+#define SERIAL_MASK  0x00000FFFFF000000ul
+#define PAYLOAD_BITS 64
+
+// Sliced samples per Manchester half bit
+#define SAMPLES_PER_CHIP 8
 
 // Don't send these messages more than once per minute unless there is a state change
 #define RX_GOOD_MIN_SEC (60)
@@ -39,67 +42,68 @@
 #define LOW_BAT_MSG "LOW"
 #define OK_BAT_MSG "OK"
 
-void DigitalDecoder::sendDeviceState(uint32_t serial, deviceState_t ds)
+void DigitalDecoder::publish()
 {
-    std::ostringstream oss;
+    for(OutputSink *sink : sinks)
+    {
+        sink->publish(serializer.topic(), serializer.topicLength(), serializer.payload(), serializer.payloadLength());
+    }
+}
+
+void DigitalDecoder::sendDeviceState(uint32_t serial, deviceState_t ds, uint64_t sampleIndex)
+{
+    if(sinks.empty()) return;
+
+    serializer.begin(BASE_TOPIC, serial);
+    serializer.addUInt("serial", serial);
+    serializer.addBool("isMotion", ds.isMotionDetector);
+    serializer.addBool("tamper", ds.tamper);
+    serializer.addBool("alarm", ds.alarm);
+    serializer.addBool("batteryLow", ds.batteryLow);
+    serializer.addBool("heartbeat", ds.heartbeat);
+    serializer.addTime("lastUpdateTime", (time_t)ds.lastUpdateTime);
+    serializer.addTime("lastAlarmTime", (time_t)ds.lastAlarmTime);
+    serializer.addUInt("rxTimeUs", ds.lastUpdateTimeUs);
+
     //
-    // Use mosquitto_pub to send device state to the MQTT server.
+    // How long since the frame was on the air; only meaningful when receiving live.
     //
+    if(sampleClock && sampleClock->isLive())
+    {
+        const int64_t latencyUs = SampleClock::monotonicNowUs() - sampleClock->toMonotonicUs(sampleIndex);
+        serializer.addUInt("latencyUs", latencyUs > 0 ? latencyUs : 0);
+    }
 
-    oss << "/usr/bin/mosquitto_pub";
-    oss << " -h 192.168.0.35";
-    oss << " -u mqtt-alarm2";
-    oss << " -P honeywell54312!";
-    oss << " -i HoneywellSecurity -r";
-    oss << " -t 'ha/sensor/alarm/" << serial << "' ";
-    oss << " -m '";   
-    oss << "{";
-    oss << "\"serial\": " << serial << ",";
-    oss << "\"isMotion\": " << (ds.isMotionDetector ? "true," : "false,");
-    oss << "\"tamper\": " << (ds.tamper ? "true," : "false,");
-    oss << "\"alarm\": " << (ds.alarm ? "true," : "false,");
-    oss << "\"batteryLow\": " << (ds.batteryLow ? "true," : "false,");
-    oss << "\"heartbeat\": " << (ds.heartbeat ? "true," : "false,");
-
-    time_t lastUpdateTime = (time_t)ds.lastUpdateTime;
-    oss << "\"lastUpdateTime\": " << std::put_time(std::localtime(&lastUpdateTime), "\"%c %Z\"") << ",";
-
-    time_t lastAlarmTime = (time_t)ds.lastAlarmTime;
-    oss << "\"lastAlarmTime\": " << std::put_time(std::localtime(&lastAlarmTime), "\"%c %Z\"");
-    oss << "}'";
-
-    std::cout << oss.str() << std::endl;
-
-    system(oss.str().c_str());
+    serializer.end();
+
+    publish();
+}
+
+void DigitalDecoder::sendSensorState(const char *topic, uint32_t serial, const char *state)
+{
+    if(sinks.empty()) return;
+
+    serializer.begin(topic, serial);
+    serializer.addUInt("serial", serial);
+    serializer.addString("state", state);
+    serializer.end();
+
+    publish();
 }
 
 void DigitalDecoder::setRxGood(bool state)
 {
-    std::string topic(BASE_TOPIC);
     timeval now;
 
-    topic += "rx_status";
-
     gettimeofday(&now, nullptr);
 
     if (rxGood != state || (now.tv_sec - lastRxGoodUpdateTime) > RX_GOOD_MIN_SEC)
     {
-              std::ostringstream oss;
-    oss << "/usr/bin/mosquitto_pub";
-    oss << " -h 192.168.0.35";
-    oss << " -u mqtt-alarm2";
-    oss << " -P honeywell54312!";
-    oss << " -i HoneywellSecurity -r";
-    oss << " -t '" << topic.c_str() << "' ";
-    oss << " -m '";
-    oss << "{";
-    oss << "\"state\": " << (state ? "OK" : "FAILED");
-    oss << "}'";
-
-    std::cout << oss.str() << std::endl;
-
-    system(oss.str().c_str());
-        
+        serializer.begin(BASE_TOPIC "rx_status");
+        serializer.addString("state", state ? "OK" : "FAILED");
+        serializer.end();
+
+        publish();
     }
 
     // Reset watchdog either way
@@ -109,15 +113,12 @@ void DigitalDecoder::setRxGood(bool state)
     lastRxGoodUpdateTime = now.tv_sec;
 }
 
-void DigitalDecoder::updateSensorState(uint32_t serial, uint64_t payload)
+void DigitalDecoder::updateSensorState(uint32_t serial, uint64_t payload, int64_t timeUs)
 {
-    timeval now;
-    gettimeofday(&now, nullptr);
-
     struct sensorState_t lastState;
     struct sensorState_t currentState;
 
-    currentState.lastUpdateTime = now.tv_sec;
+    currentState.lastUpdateTime = timeUs/1000000;
     currentState.hasLostSupervision = false;
 
     currentState.loop1 = payload  & 0x000000800000;
@@ -156,130 +157,37 @@ void DigitalDecoder::updateSensorState(uint32_t serial, uint64_t payload)
 
     if ((currentState.loop1 != lastState.loop1) || supervised)
     {
-        
-        std::ostringstream oss;
-    oss << "/usr/bin/mosquitto_pub";
-    oss << " -h 192.168.0.35";
-    oss << " -u mqtt-alarm2";
-    oss << " -P honeywell54312!";
-    oss << " -i HoneywellSecurity -r";
-    oss << " -t 'ha/sensor/alarm/loop1/" << serial << "' ";
-    oss << " -m '";
-    oss << "{";
-    oss << "\"serial\": " << serial << ",";
-    oss << "\"state\": " << (currentState.loop1 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG);
-    oss << "}'";
-
-    std::cout << oss.str() << std::endl;
-
-    system(oss.str().c_str());
-        
-        /*std::ostringstream topic;
-        topic << SENSOR_TOPIC << serial << "/loop1";
-        mqtt.send(topic.str().c_str(), currentState.loop1 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG, supervised ? 0 : 1);
-    */
+        sendSensorState(BASE_TOPIC "loop1/", serial, currentState.loop1 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG);
     }
 
     if ((currentState.loop2 != lastState.loop2) || supervised)
     {
-          std::ostringstream oss;
-    oss << "/usr/bin/mosquitto_pub";
-    oss << " -h 192.168.0.35";
-    oss << " -u mqtt-alarm2";
-    oss << " -P honeywell54312!";
-    oss << " -i HoneywellSecurity -r";
-    oss << " -t 'ha/sensor/alarm/loop2/" << serial << "' ";
-    oss << " -m '";
-    oss << "{";
-    oss << "\"serial\": " << serial << ",";
-    oss << "\"state\": " << (currentState.loop2 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG);
-    oss << "}'";
-
-    std::cout << oss.str() << std::endl;
-
-    system(oss.str().c_str());
-      
+        sendSensorState(BASE_TOPIC "loop2/", serial, currentState.loop2 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG);
     }
 
     if ((currentState.loop3 != lastState.loop3) || supervised)
     {
-          std::ostringstream oss;
-    oss << "/usr/bin/mosquitto_pub";
-    oss << " -h 192.168.0.35";
-    oss << " -u mqtt-alarm2";
-    oss << " -P honeywell54312!";
-    oss << " -i HoneywellSecurity -r";
-    oss << " -t 'ha/sensor/alarm/loop3/" << serial << "' ";
-    oss << " -m '";
-    oss << "{";
-    oss << "\"serial\": " << serial << ",";
-    oss << "\"state\": " << (currentState.loop3 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG);
-    oss << "}'";
-
-    std::cout << oss.str() << std::endl;
-
-    system(oss.str().c_str());
-      
+        sendSensorState(BASE_TOPIC "loop3/", serial, currentState.loop3 ? OPEN_SENSOR_MSG : CLOSED_SENSOR_MSG);
     }
 
     if ((currentState.tamper != lastState.tamper) || supervised)
     {
-     
-    std::ostringstream oss;
-    oss << "/usr/bin/mosquitto_pub";
-    oss << " -h 192.168.0.35";
-    oss << " -u mqtt-alarm2";
-    oss << " -P honeywell54312!";
-    oss << " -i HoneywellSecurity -r";
-    oss << " -t 'ha/sensor/alarm/tamper/" << serial << "' ";
-    oss << " -m '";
-    oss << "{";
-    oss << "\"serial\": " << serial << ",";
-    oss << "\"state\": " << (currentState.tamper ? TAMPER_MSG : UNTAMPERED_MSG);
-    oss << "}'";
-
-    std::cout << oss.str() << std::endl;
-
-    system(oss.str().c_str());
-        
-       /* 
-        std::ostringstream topic;
-        topic << SENSOR_TOPIC << serial << "/tamper";
-        mqtt.send(topic.str().c_str(), currentState.tamper ? TAMPER_MSG : UNTAMPERED_MSG, supervised ? 0 : 1);
-    */
+        sendSensorState(BASE_TOPIC "tamper/", serial, currentState.tamper ? TAMPER_MSG : UNTAMPERED_MSG);
     }
 
     if ((currentState.lowBat != lastState.lowBat) || supervised)
     {
-     std::ostringstream oss;
-    oss << "/usr/bin/mosquitto_pub";
-    oss << " -h 192.168.0.35";
-    oss << " -u mqtt-alarm2";
-    oss << " -P honeywell54312!";
-    oss << " -i HoneywellSecurity -r";
-    oss << " -t 'ha/sensor/alarm/battery/" << serial << "' ";
-    oss << " -m '";
-    oss << "{";
-    oss << "\"serial\": " << serial << ",";
-    oss << "\"state\": " << (currentState.lowBat ? LOW_BAT_MSG : OK_BAT_MSG);
-    oss << "}'";
-
-    std::cout << oss.str() << std::endl;
-
-    system(oss.str().c_str());
-        /*
-        std::ostringstream topic;
-        topic << SENSOR_TOPIC << serial << "/battery";
-        mqtt.send(topic.str().c_str(), currentState.lowBat ? LOW_BAT_MSG : OK_BAT_MSG, supervised ? 0 : 1);
-    */
+        sendSensorState(BASE_TOPIC "battery/", serial, currentState.lowBat ? LOW_BAT_MSG : OK_BAT_MSG);
     }
 
     sensorStatusMap[serial] = currentState;
 }
 
 
-void DigitalDecoder::updateDeviceState(uint32_t serial, uint8_t state)
+void DigitalDecoder::updateDeviceState(uint32_t serial, uint8_t state, uint64_t sampleIndex)
 {
+    const int64_t timeUs = frameTimeUs(sampleIndex);
+
     deviceState_t ds;
     
     //
@@ -293,6 +201,10 @@ void DigitalDecoder::updateDeviceState(uint32_t serial, uint8_t state)
     else
     {
         ds.isMotionDetector = false;
+        ds.lastAlarmTime = 0;
+
+        // Never seen before, so always report it
+        ds.lastRawState = ~state;
     }
     
     //
@@ -333,11 +245,10 @@ void DigitalDecoder::updateDeviceState(uint32_t serial, uint8_t state)
     // Timestamp.
     //
 
-    timeval now;
-    gettimeofday(&now, nullptr);
-    ds.lastUpdateTime = now.tv_sec;
+    ds.lastUpdateTimeUs = timeUs;
+    ds.lastUpdateTime = timeUs/1000000;
     
-    if(ds.alarm) ds.lastAlarmTime = now.tv_sec;
+    if(ds.alarm) ds.lastAlarmTime = ds.lastUpdateTime;
 
     //
     // Put the answer back in the map.
@@ -351,56 +262,93 @@ void DigitalDecoder::updateDeviceState(uint32_t serial, uint8_t state)
     
     if(state != ds.lastRawState)
     {
-        //Update 2020:  Commented this out to build successfully.
-        sendDeviceState(serial, ds);
+        sendDeviceState(serial, ds, sampleIndex);
     }
 
     deviceStateMap[serial].lastRawState = state;
     
-    for(const auto &dd : deviceStateMap)
+    if(outputEnabled)
     {
-        printf("%sDevice %7u: %s\n",dd.first==serial ? "*" : " ", dd.first, dd.second.alarm ? "ALARM" : "OK");
-    }
+        for(const auto &dd : deviceStateMap)
+        {
+            printf("%sDevice %7u: %s\n",dd.first==serial ? "*" : " ", dd.first, dd.second.alarm ? "ALARM" : "OK");
+        }
 
-    printf("\n");
+        printf("\n");
+    }
 }
 
 
-void DigitalDecoder::handlePayload(uint64_t payload)
+uint64_t DigitalDecoder::crcRemainder(uint64_t value, uint64_t polynomial)
 {
-    uint64_t sof = (payload & 0xF00000000000) >> 44;
-    uint64_t ser = (payload & 0x0FFFFF000000) >> 24;
-    uint64_t typ = (payload & 0x000000FF0000) >> 16;
-    uint64_t crc = (payload & 0x00000000FFFF) >>  0;
-    
     //
-    // Check CRC
+    // Polynomial long division, one bit at a time from the top.
     //
-    const uint64_t polynomial = 0x18005;
-    uint64_t sum = payload & (~SYNC_MASK);
-    uint64_t current_divisor = polynomial << 31;
+    int degree = 63;
+    while(degree > 0 && !(polynomial & (1ull << degree))) degree--;
     
-    while(current_divisor >= polynomial)
+    for(int bit = 63; bit >= degree; --bit)
     {
-#ifdef __arm__
-        if(__builtin_clzll(sum) == __builtin_clzll(current_divisor))
-#else        
-        if(__builtin_clzl(sum) == __builtin_clzl(current_divisor))
-#endif
+        if(value & (1ull << bit))
         {
-            sum ^= current_divisor;
-        }        
-        current_divisor >>= 1;
+            value ^= polynomial << (bit - degree);
+        }
     }
     
-    const bool valid = (sum == 0);
+    return value;
+}
+
+bool DigitalDecoder::isPayloadValid(uint64_t payload, uint64_t polynomial)
+{
+    if(polynomial == 0) polynomial = CRC_POLYNOMIAL;
+    
+    return crcRemainder(payload & (~SYNC_MASK), polynomial) == 0;
+}
+
+uint64_t DigitalDecoder::frameSamples()
+{
+    // Two chips per bit
+    return (uint64_t)PAYLOAD_BITS*2*SAMPLES_PER_CHIP*AnalogDecoder::HW_RATIO;
+}
+
+void DigitalDecoder::writeFrameLog(FILE *out, uint64_t payload, uint64_t sampleIndex, const SampleClock &clock)
+{
+    const int64_t us = clock.toRealtimeUs(sampleIndex);
+    fprintf(out, "%llu\t%lld.%06lld\t%016llX\t%u\t%02X\n",
+        (unsigned long long)sampleIndex,
+        (long long)(us/1000000), (long long)(us%1000000),
+        (unsigned long long)payload,
+        (unsigned int)((payload & SERIAL_MASK) >> 24),
+        (unsigned int)((payload >> 16) & 0xFF));
+}
+
+int64_t DigitalDecoder::frameTimeUs(uint64_t sampleIndex) const
+{
+    if(sampleClock) return sampleClock->toRealtimeUs(sampleIndex);
+
+    //
+    // Nothing to anchor against, so fall back to arrival time.
+    //
+    timeval now;
+    gettimeofday(&now, nullptr);
+    return (int64_t)now.tv_sec*1000000 + now.tv_usec;
+}
+
+void DigitalDecoder::handlePayload(uint64_t payload, bool valid, uint64_t sampleIndex)
+{
+    uint64_t sof = (payload & 0xF00000000000) >> 44;
+    uint64_t ser = (payload & 0x0FFFFF000000) >> 24;
+    uint64_t typ = (payload & 0x000000FF0000) >> 16;
+    uint64_t crc = (payload & 0x00000000FFFF) >>  0;
     
     //
     // Tell the world
     //
+    if(payloadCb) payloadCb(payload, valid, sampleIndex);
+
     if(valid)
     {
-        updateDeviceState(ser, typ);
+        updateDeviceState(ser, typ, sampleIndex);
     }
     
     
@@ -419,118 +367,40 @@ void DigitalDecoder::handlePayload(uint64_t payload)
 //         printf("Invalid Payload: %lX\n", payload);
 // #endif
     
-    static uint32_t packetCount = 0;
-    static uint32_t errorCount = 0;
-    
     packetCount++;
     if(!valid)
     {
         errorCount++;
-        printf("%u/%u packets failed CRC\n", errorCount, packetCount);
+        if(outputEnabled) printf("%u/%u packets failed CRC\n", errorCount, packetCount);
+        if(anomalyCb) anomalyCb(ANOMALY_CRC_FAILURE);
     }
 }
 
-void DigitalDecoder::handleBit(bool value)
+void DigitalDecoder::handleSyncLoss(uint64_t partial)
 {
-    static uint64_t payload = 0;
-
-    payload <<= 1;
-    payload |= (value ? 1 : 0);
-    
-    //
-    // If we see a new pattern, but the previous payload wasn't complete.
-    //
-
-    if (((payload & 0xFFFEul) == 0xFFFEul) && (payload != 0xFFFEul))
+    if(outputEnabled)
     {
 #ifdef __arm__
-        printf("Previous payload: %llX\n", payload >> 16);
+        printf("Previous payload: %llX\n", partial);
 #else
-        printf("Previous payload: %lX\n", payload >> 16);
+        printf("Previous payload: %lX\n", partial);
 #endif     
     }
-
-#if 0
-#ifdef __arm__
-    printf("Got bit: %d, payload is now %llX\n", value?1:0, payload);
-#else
-    printf("Got bit: %d, payload is now %lX\n", value?1:0, payload);
-#endif     
-#endif
-
-    if((payload & SYNC_MASK) == SYNC_PATTERN)
-    {
-        handlePayload(payload);
-        payload = 0;
-    }
+    if(anomalyCb) anomalyCb(ANOMALY_SYNC_LOSS);
 }
 
-void DigitalDecoder::decodeBit(bool value)
+void DigitalDecoder::registerProtocols(ProtocolRegistry &registry)
 {
-    enum ManchesterState
-    {
-        LOW_PHASE_A,
-        LOW_PHASE_B,
-        HIGH_PHASE_A,
-        HIGH_PHASE_B
-    };
-    
-    static ManchesterState state = LOW_PHASE_A;
-    
-    switch(state)
-    {
-        case LOW_PHASE_A:
-        {
-            state = value ? HIGH_PHASE_B : LOW_PHASE_A;
-            break;
-        }
-        case LOW_PHASE_B:
-        {
-            handleBit(false);
-            state = value ? HIGH_PHASE_A : LOW_PHASE_A;
-            break;
-        }
-        case HIGH_PHASE_A:
-        {
-            state = value ? HIGH_PHASE_A : LOW_PHASE_B;
-            break;
-        }
-        case HIGH_PHASE_B:
-        {
-            handleBit(true);
-            state = value ? HIGH_PHASE_A : LOW_PHASE_A;
-            break;
-        }
-    }
-}
-
-void DigitalDecoder::handleData(char data)
-{
-    static const int samplesPerBit = 8;
-    
-        
-    if(data != 0 && data != 1) return;
-        
-    const bool thisSample = (data == 1);
-    
-    if(thisSample == lastSample)
-    {
-        samplesSinceEdge++;
-        
-        //if(samplesSinceEdge < 100)
-        //{
-        //    printf("At %d for %u\n", thisSample?1:0, samplesSinceEdge);
-        //}
-        
-        if((samplesSinceEdge % samplesPerBit) == (samplesPerBit/2))
-        {
-            // This Sample is a new bit
-            decodeBit(thisSample);
-        }
-    }
-    else
-    {
-        samplesSinceEdge = 1;
-    }
-    lastSample = thisSample;
+    protocol_t honeywell;
+    honeywell.name = "honeywell";
+    honeywell.samplesPerChip = SAMPLES_PER_CHIP;
+    honeywell.frameBits = PAYLOAD_BITS;
+    honeywell.preambleBits = SYNC_BITS;
+    honeywell.preamble = SYNC_PATTERN >> (PAYLOAD_BITS - SYNC_BITS);
+    honeywell.checksum = [](uint64_t payload){return isPayloadValid(payload);};
+    honeywell.sourceMask = SERIAL_MASK;
+    honeywell.onFrame = [this](uint64_t payload, bool valid, uint64_t sampleIndex){handlePayload(payload, valid, sampleIndex);};
+    honeywell.onSyncLoss = [this](uint64_t partial){handleSyncLoss(partial);};
+
+    registry.add(honeywell);
 }
@@ -2,18 +2,67 @@
 #define __DIGITAL_DECODER_H__
 
 #include <stdint.h>
+#include <cstdio>
 #include <map>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "eventSerializer.h"
+#include "outputSink.h"
+#include "protocolRegistry.h"
+
+class SampleClock;
 
 class DigitalDecoder
 {
   public:
+    enum Anomaly
+    {
+        ANOMALY_CRC_FAILURE,
+        ANOMALY_SYNC_LOSS
+    };
+
+    // The Honeywell frame: sync word in the top bits, CRC-16 in the bottom
+    static const uint64_t SYNC_PATTERN = 0xFFFE000000000000ul;
+    static const uint64_t CRC_POLYNOMIAL = 0x18005ul;
+
     DigitalDecoder() = default;
     
-    void handleData(char data);
+    // Adds the Honeywell 345MHz frame format, feeding frames into this decoder
+    void registerProtocols(ProtocolRegistry &registry);
+    
     void setRxGood(bool state);
-  
-  protected:
-    bool isPayloadValid(uint64_t payload, uint64_t polynomial=0) const;
+    void setAnomalyCallback(std::function<void(Anomaly)> cb) {anomalyCb = cb;};
+    
+    // Called for every framed payload with its CRC result and the sample index of its sync word
+    void setPayloadCallback(std::function<void(uint64_t, bool, uint64_t)> cb) {payloadCb = cb;};
+    
+    // Frames are stamped from their sample index; without a clock they get arrival time
+    void setSampleClock(const SampleClock *clock) {sampleClock = clock;};
+    
+    // Every state change is serialized once and handed to each sink in turn
+    void addSink(OutputSink *sink) {sinks.push_back(sink);};
+    
+    // Console diagnostics; turned off by the offline harnesses
+    void setOutputEnabled(bool enabled) {outputEnabled = enabled;};
+    
+    // Entries in the per-serial state maps, for the load harness. The sensor map only
+    // fills through updateSensorState(), which nothing calls yet, so it stays empty.
+    size_t getDeviceCount() const {return deviceStateMap.size();};
+    size_t getSensorCount() const {return sensorStatusMap.size();};
+    
+    // Where framed payloads enter; also lets harnesses inject payloads without RF
+    void handlePayload(uint64_t payload, bool valid, uint64_t sampleIndex);
+    
+    static uint64_t crcRemainder(uint64_t value, uint64_t polynomial);
+    static bool isPayloadValid(uint64_t payload, uint64_t polynomial=0);
+    
+    // Raw samples a whole frame spans at the nominal chip length
+    static uint64_t frameSamples();
+    
+    // One line of the offline tools' frame log: sample index, wall time, payload, serial, status
+    static void writeFrameLog(FILE *out, uint64_t payload, uint64_t sampleIndex, const SampleClock &clock);
   
   private:
     
@@ -21,6 +70,7 @@ class DigitalDecoder
     {
         uint64_t lastUpdateTime;
         uint64_t lastAlarmTime;
+        int64_t lastUpdateTimeUs;
         
         uint8_t lastRawState;
         
@@ -32,26 +82,31 @@ class DigitalDecoder
         bool isMotionDetector;
     };
 
-    void sendDeviceState(uint32_t serial, deviceState_t ds);
-    void updateDeviceState(uint32_t serial, uint8_t state);
+    void publish();
+    void sendDeviceState(uint32_t serial, deviceState_t ds, uint64_t sampleIndex);
+    void sendSensorState(const char *topic, uint32_t serial, const char *state);
+    void updateDeviceState(uint32_t serial, uint8_t state, uint64_t sampleIndex);
     void writeDeviceState();
     //void sendDeviceState();
-    void updateSensorState(uint32_t serial, uint64_t payload);
+    void updateSensorState(uint32_t serial, uint64_t payload, int64_t timeUs);
     void updateKeypadState(uint32_t serial, uint64_t payload);
     void updateKeyfobState(uint32_t serial, uint64_t payload);
-    void handlePayload(uint64_t payload);
-    void handleBit(bool value);
-    void decodeBit(bool value);
+    int64_t frameTimeUs(uint64_t sampleIndex) const;
+    void handleSyncLoss(uint64_t partial);
     void checkForTimeouts();
 
 
-    unsigned int samplesSinceEdge = 0;
-    bool lastSample = false;
     bool rxGood = false;
     uint64_t lastRxGoodUpdateTime = 0;
     //Mqtt &mqtt;  //Not using the mqtt in vondruska release
     uint32_t packetCount = 0;
     uint32_t errorCount = 0;
+    const SampleClock *sampleClock = nullptr;
+    bool outputEnabled = true;
+    std::function<void(Anomaly)> anomalyCb;
+    std::function<void(uint64_t, bool, uint64_t)> payloadCb;
+    EventSerializer serializer;
+    std::vector<OutputSink *> sinks;
   
    struct sensorState_t
     {
@@ -0,0 +1,133 @@
+#include "eventSerializer.h"
+
+#include <cstring>
+
+// Matches what std::put_time(..., "%c %Z") used to produce
+#define TIME_FORMAT "%c %Z"
+
+static size_t formatUInt(char *out, uint64_t value)
+{
+    char digits[20];
+    size_t len = 0;
+
+    do
+    {
+        digits[len++] = '0' + (value % 10);
+        value /= 10;
+    } while(value);
+
+    for(size_t ii = 0; ii < len; ++ii)
+    {
+        out[ii] = digits[len - 1 - ii];
+    }
+
+    return len;
+}
+
+void EventSerializer::begin(const char *topicPrefix)
+{
+    m_topicLen = strnlen(topicPrefix, TOPIC_MAX - 1);
+    memcpy(m_topic, topicPrefix, m_topicLen);
+    m_topic[m_topicLen] = '\0';
+
+    m_payload[0] = '{';
+    m_payloadLen = 1;
+    m_firstField = true;
+}
+
+void EventSerializer::begin(const char *topicPrefix, uint32_t serial)
+{
+    begin(topicPrefix);
+
+    if(m_topicLen + 10 < TOPIC_MAX)
+    {
+        m_topicLen += formatUInt(m_topic + m_topicLen, serial);
+        m_topic[m_topicLen] = '\0';
+    }
+}
+
+void EventSerializer::addUInt(const char *key, uint64_t value)
+{
+    addKey(key);
+    appendUInt(value);
+}
+
+void EventSerializer::addBool(const char *key, bool value)
+{
+    addKey(key);
+    append(value ? "true" : "false");
+}
+
+void EventSerializer::addString(const char *key, const char *value)
+{
+    addKey(key);
+    append("\"", 1);
+    append(value);
+    append("\"", 1);
+}
+
+void EventSerializer::addTime(const char *key, time_t value)
+{
+    //
+    // localtime/strftime are slow; only redo them when the second changes.
+    //
+
+    timeCache_t *entry = nullptr;
+    for(auto &cached : m_timeCache)
+    {
+        if(cached.time == value) entry = &cached;
+    }
+
+    if(!entry)
+    {
+        entry = &m_timeCache[m_nextTimeSlot];
+        m_nextTimeSlot = (m_nextTimeSlot + 1) % 2;
+
+        struct tm local;
+        localtime_r(&value, &local);
+        entry->len = strftime(entry->text, sizeof(entry->text), TIME_FORMAT, &local);
+        entry->time = value;
+    }
+
+    addKey(key);
+    append("\"", 1);
+    append(entry->text, entry->len);
+    append("\"", 1);
+}
+
+void EventSerializer::end()
+{
+    append("}", 1);
+    m_payload[m_payloadLen] = '\0';
+}
+
+void EventSerializer::addKey(const char *key)
+{
+    if(!m_firstField) append(",", 1);
+    m_firstField = false;
+
+    append("\"", 1);
+    append(key);
+    append("\": ", 3);
+}
+
+void EventSerializer::append(const char *str, size_t len)
+{
+    // Always leave room for the closing brace and terminator
+    const size_t room = PAYLOAD_MAX - 2 - m_payloadLen;
+    if(len > room) len = room;
+
+    memcpy(m_payload + m_payloadLen, str, len);
+    m_payloadLen += len;
+}
+
+void EventSerializer::append(const char *str)
+{
+    append(str, strlen(str));
+}
+
+void EventSerializer::appendUInt(uint64_t value)
+{
+    char digits[20];
+    append(digits, formatUInt(digits, value));
+}
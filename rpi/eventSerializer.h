@@ -0,0 +1,61 @@
+#ifndef __EVENT_SERIALIZER_H__
+#define __EVENT_SERIALIZER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ctime>
+
+//
+// Formats one event at a time as a topic plus a flat JSON object, straight into
+// fixed buffers. Nothing here allocates; over-long output is truncated rather than grown.
+//
+class EventSerializer
+{
+  public:
+    static const size_t TOPIC_MAX = 128;
+    static const size_t PAYLOAD_MAX = 512;
+
+    EventSerializer() = default;
+
+    // Topic is prefix followed by the serial, if one is given
+    void begin(const char *topicPrefix);
+    void begin(const char *topicPrefix, uint32_t serial);
+
+    void addUInt(const char *key, uint64_t value);
+    void addBool(const char *key, bool value);
+    void addString(const char *key, const char *value);
+    void addTime(const char *key, time_t value);
+
+    void end();
+
+    const char *topic() const {return m_topic;};
+    size_t topicLength() const {return m_topicLen;};
+    const char *payload() const {return m_payload;};
+    size_t payloadLength() const {return m_payloadLen;};
+
+  private:
+    struct timeCache_t
+    {
+        time_t time = -1;
+        char text[64];
+        size_t len = 0;
+    };
+
+    void addKey(const char *key);
+    void append(const char *str, size_t len);
+    void append(const char *str);
+    void appendUInt(uint64_t value);
+
+    char m_topic[TOPIC_MAX];
+    size_t m_topicLen = 0;
+
+    char m_payload[PAYLOAD_MAX];
+    size_t m_payloadLen = 0;
+    bool m_firstField = true;
+
+    // Device events carry two timestamps, so cache a couple of formatted seconds
+    timeCache_t m_timeCache[2];
+    int m_nextTimeSlot = 0;
+};
+
+#endif
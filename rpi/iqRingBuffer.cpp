@@ -0,0 +1,250 @@
+#include "iqRingBuffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <dirent.h>
+
+// Extra room beyond the dump window so the writer thread can copy a window out
+// while the receive path keeps filling the ring.
+#define RING_SLACK_SECONDS (2)
+
+#define WRITER_POLL_MS (100)
+
+static const char *reasonName(IqRingBuffer::TriggerReason reason)
+{
+    switch(reason)
+    {
+        case IqRingBuffer::TRIGGER_CRC_FAILURE: return "crc";
+        case IqRingBuffer::TRIGGER_SYNC_LOSS:   return "sync";
+        case IqRingBuffer::TRIGGER_OPERATOR:    return "operator";
+    }
+    return "unknown";
+}
+
+//
+// Whether a file name is exactly one writeDump() would have picked.
+//
+static bool isDumpName(const std::string &name)
+{
+    unsigned int date, timeOfDay, rateK;
+    unsigned long long position;
+    char reason[16];
+
+    if(sscanf(name.c_str(), "iq_%8u-%6u_%llu_%15[a-z]_%uk.cu8", &date, &timeOfDay, &position, reason, &rateK) != 5) return false;
+
+    if(strcmp(reason, reasonName(IqRingBuffer::TRIGGER_CRC_FAILURE)) != 0 &&
+       strcmp(reason, reasonName(IqRingBuffer::TRIGGER_SYNC_LOSS)) != 0 &&
+       strcmp(reason, reasonName(IqRingBuffer::TRIGGER_OPERATOR)) != 0) return false;
+
+    // Print it back; anything sscanf skipped over (signs, spaces, leading zeros, a suffix) won't match
+    char expected[96];
+    snprintf(expected, sizeof(expected), "iq_%08u-%06u_%llu_%s_%uk.cu8", date, timeOfDay, position, reason, rateK);
+    return name == expected;
+}
+
+IqRingBuffer::IqRingBuffer(uint32_t sampleRate, float preSeconds, float postSeconds, const std::string &dumpDir, uint32_t maxDumps) :
+    m_sampleRate(sampleRate),
+    m_dumpDir(dumpDir),
+    m_maxDumps(maxDumps)
+{
+    // Two bytes (I and Q) per sample
+    m_preBytes = 2*(uint64_t)(preSeconds*sampleRate);
+    m_postBytes = 2*(uint64_t)(postSeconds*sampleRate);
+    m_ring.resize(m_preBytes + m_postBytes + 2*(uint64_t)RING_SLACK_SECONDS*sampleRate);
+
+    if(m_maxDumps > 0)
+    {
+        findDumps();
+        pruneDumps();
+    }
+
+    m_writer = std::thread(&IqRingBuffer::writerLoop, this);
+}
+
+IqRingBuffer::~IqRingBuffer()
+{
+    m_running = false;
+    m_wake.notify_one();
+    m_writer.join();
+}
+
+void IqRingBuffer::push(const unsigned char *buf, uint32_t len)
+{
+    const uint64_t size = m_ring.size();
+    uint64_t count = m_writeCount.load(std::memory_order_relaxed);
+
+    //
+    // Only the tail of an oversized buffer can survive anyway.
+    //
+
+    if(len > size)
+    {
+        buf += len - size;
+        count += len - size;
+        len = size;
+    }
+
+    const uint64_t offset = count % size;
+    const uint64_t first = std::min<uint64_t>(len, size - offset);
+
+    memcpy(&m_ring[offset], buf, first);
+    memcpy(&m_ring[0], buf + first, len - first);
+
+    m_writeCount.store(count + len, std::memory_order_release);
+
+    if(m_operatorRequest.exchange(false))
+    {
+        trigger(TRIGGER_OPERATOR);
+    }
+}
+
+void IqRingBuffer::trigger(TriggerReason reason)
+{
+    if(m_maxDumps == 0) return;
+
+    const uint64_t position = m_writeCount.load(std::memory_order_relaxed);
+
+    //
+    // Repeated frames in one burst tend to fail together; one window covers them all.
+    //
+
+    if(position < m_lastTriggerEnd && reason != TRIGGER_OPERATOR) return;
+
+    const uint32_t head = m_pendingHead.load(std::memory_order_relaxed);
+    const uint32_t tail = m_pendingTail.load(std::memory_order_acquire);
+
+    // Writer is behind; drop rather than block the receive path
+    if(head - tail >= MAX_PENDING_DUMPS) return;
+
+    m_pending[head % MAX_PENDING_DUMPS].position = position;
+    m_pending[head % MAX_PENDING_DUMPS].reason = reason;
+    m_pendingHead.store(head + 1, std::memory_order_release);
+
+    m_lastTriggerEnd = position + m_postBytes;
+}
+
+void IqRingBuffer::writerLoop()
+{
+    bool running = true;
+
+    while(running)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait_for(lock, std::chrono::milliseconds(WRITER_POLL_MS));
+        }
+
+        // Take one last pass on shutdown so pending windows are flushed with what we have
+        running = m_running;
+
+        uint32_t tail = m_pendingTail.load(std::memory_order_relaxed);
+        while(tail != m_pendingHead.load(std::memory_order_acquire))
+        {
+            const pendingDump_t &dump = m_pending[tail % MAX_PENDING_DUMPS];
+
+            // Wait until the post-trigger part of the window has arrived
+            if(running && m_writeCount.load(std::memory_order_acquire) < dump.position + m_postBytes) break;
+
+            writeDump(dump);
+
+            tail++;
+            m_pendingTail.store(tail, std::memory_order_release);
+        }
+    }
+}
+
+void IqRingBuffer::findDumps()
+{
+    DIR *dir = opendir(m_dumpDir.c_str());
+    if(!dir) return;
+
+    //
+    // Names start with the time, so sorting them sorts by age.
+    //
+
+    std::vector<std::string> names;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != nullptr)
+    {
+        const std::string name = entry->d_name;
+        if(isDumpName(name))
+        {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+
+    std::sort(names.begin(), names.end());
+    for(const auto &name : names)
+    {
+        m_dumps.push_back(m_dumpDir + "/" + name);
+    }
+}
+
+void IqRingBuffer::pruneDumps()
+{
+    while(m_dumps.size() > m_maxDumps)
+    {
+        std::cout << "Removing old IQ dump " << m_dumps.front() << std::endl;
+        remove(m_dumps.front().c_str());
+        m_dumps.pop_front();
+    }
+}
+
+void IqRingBuffer::writeDump(const pendingDump_t &dump)
+{
+    const uint64_t size = m_ring.size();
+    const uint64_t count = m_writeCount.load(std::memory_order_acquire);
+    const uint64_t oldest = (count > size) ? (count - size) : 0;
+
+    uint64_t start = (dump.position > m_preBytes) ? (dump.position - m_preBytes) : 0;
+    uint64_t end = std::min(count, dump.position + m_postBytes);
+    start = std::max(start, oldest);
+
+    //
+    // Name it like rtl_sdr captures so existing tools pick up the sample rate.
+    //
+
+    char timeStr[32];
+    time_t now = time(nullptr);
+    strftime(timeStr, sizeof(timeStr), "%Y%m%d-%H%M%S", localtime(&now));
+
+    char fileName[96];
+    snprintf(fileName, sizeof(fileName), "/iq_%s_%llu_%s_%uk.cu8", timeStr, (unsigned long long)(dump.position/2), reasonName(dump.reason), m_sampleRate/1000);
+    const std::string path = m_dumpDir + fileName;
+
+    FILE *fp = fopen(path.c_str(), "wb");
+    if(!fp)
+    {
+        std::cout << "Failed to open " << path << " for IQ dump" << std::endl;
+        return;
+    }
+
+    const uint64_t offset = start % size;
+    const uint64_t len = end - start;
+    const uint64_t first = std::min(len, size - offset);
+
+    fwrite(&m_ring[offset], 1, first, fp);
+    fwrite(&m_ring[0], 1, len - first, fp);
+    fclose(fp);
+
+    //
+    // If the receive path lapped us while writing, the start of the file is torn.
+    //
+
+    if(m_writeCount.load(std::memory_order_acquire) > start + size)
+    {
+        std::cout << "IQ dump " << path << " was overwritten while writing, discarding" << std::endl;
+        remove(path.c_str());
+        return;
+    }
+
+    std::cout << "Wrote " << len/2 << " IQ samples to " << path << std::endl;
+
+    m_dumps.push_back(path);
+    pruneDumps();
+}
@@ -0,0 +1,82 @@
+#ifndef __IQ_RING_BUFFER_H__
+#define __IQ_RING_BUFFER_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Holds the last few seconds of raw 8-bit IQ so the signal around an anomaly
+// (CRC failure, lost sync, operator request) can be written to disk after the fact.
+//
+// push() and trigger() are called from the receive callback and never allocate,
+// lock or touch the disk. requestDump() only sets a flag, so it is safe to call
+// from a signal handler. All file I/O happens on a background writer thread.
+//
+// At most maxDumps dumps are kept in dumpDir (earlier runs' included); the oldest
+// is deleted to make room for a new one. Only files named the way the dumps are
+// count, and a maxDumps of 0 turns dumping off without touching the directory.
+//
+class IqRingBuffer
+{
+  public:
+    enum TriggerReason
+    {
+        TRIGGER_CRC_FAILURE,
+        TRIGGER_SYNC_LOSS,
+        TRIGGER_OPERATOR
+    };
+
+    IqRingBuffer(uint32_t sampleRate, float preSeconds, float postSeconds, const std::string &dumpDir, uint32_t maxDumps);
+    ~IqRingBuffer();
+
+    void push(const unsigned char *buf, uint32_t len);
+    void trigger(TriggerReason reason);
+    void requestDump() {m_operatorRequest = true;};
+
+  private:
+    struct pendingDump_t
+    {
+        uint64_t position;
+        TriggerReason reason;
+    };
+
+    static const uint32_t MAX_PENDING_DUMPS = 16;
+
+    void writerLoop();
+    void writeDump(const pendingDump_t &dump);
+    void findDumps();
+    void pruneDumps();
+
+    std::vector<unsigned char> m_ring;
+    uint64_t m_preBytes;
+    uint64_t m_postBytes;
+    uint32_t m_sampleRate;
+    std::string m_dumpDir;
+    uint32_t m_maxDumps;
+
+    // Dumps on disk, oldest first; only the writer thread touches this
+    std::deque<std::string> m_dumps;
+
+    // Total bytes ever pushed; the ring holds the most recent m_ring.size() of them
+    std::atomic<uint64_t> m_writeCount{0};
+
+    // Single producer (receive path), single consumer (writer thread)
+    pendingDump_t m_pending[MAX_PENDING_DUMPS];
+    std::atomic<uint32_t> m_pendingHead{0};
+    std::atomic<uint32_t> m_pendingTail{0};
+    uint64_t m_lastTriggerEnd = 0;
+
+    std::atomic<bool> m_operatorRequest{false};
+    std::atomic<bool> m_running{true};
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_writer;
+};
+
+#endif
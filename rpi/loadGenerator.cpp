@@ -0,0 +1,366 @@
+#include "digitalDecoder.h"
+#include "outputSink.h"
+#include "sampleClock.h"
+#include "signalGenerator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+//
+// Drives DigitalDecoder with CRC-valid payloads at the handlePayload boundary,
+// modelling a large site in simulated time, to find where state tracking and
+// publishing stop keeping up. RF is not involved.
+//
+
+#define SAMPLE_RATE (1000000)
+
+#define FRAME_SAMPLES (DigitalDecoder::frameSamples())
+
+#define SERIAL_BASE (100000)
+
+#define DEFAULT_SENSORS         (5000)
+#define DEFAULT_SUPERVISION_SEC (3600)
+#define DEFAULT_REPEATS         (4)
+#define DEFAULT_DURATION_SEC    (4*3600)
+#define DEFAULT_EVENTS_PER_HOUR (1.0f)
+
+#define STORM_HOLD_SEC (60)
+#define MEMORY_SAMPLES (10)
+
+// Status bits, as DigitalDecoder::updateDeviceState reads them
+#define STATUS_LOOP1     0x80
+#define STATUS_LOOP2     0x20
+#define STATUS_HEARTBEAT 0x04
+
+struct injection_t
+{
+    uint64_t sampleIndex;
+    uint64_t payload;
+
+    bool operator<(const injection_t &other) const {return sampleIndex < other.sampleIndex;};
+};
+
+//
+// Counts what the decoder publishes when no broker is wanted.
+//
+class CountingSink : public OutputSink
+{
+  public:
+    void publish(const char *, size_t topicLen, const char *, size_t payloadLen) override
+    {
+        messages++;
+        bytes += topicLen + payloadLen;
+    }
+
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+};
+
+//
+// Just enough of an MQTT broker on loopback to accept one client and count its PUBLISHes.
+//
+class LocalBroker
+{
+  public:
+    LocalBroker()
+    {
+        m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+
+        socklen_t len = sizeof(addr);
+        bind(m_listenFd, (struct sockaddr *)&addr, sizeof(addr));
+        listen(m_listenFd, 1);
+        getsockname(m_listenFd, (struct sockaddr *)&addr, &len);
+        port = ntohs(addr.sin_port);
+
+        m_thread = std::thread(&LocalBroker::serve, this);
+    }
+
+    ~LocalBroker()
+    {
+        finish();
+        close(m_listenFd);
+    }
+
+    // Returns once the client has disconnected and everything it sent is counted
+    void finish()
+    {
+        if(m_thread.joinable()) m_thread.join();
+    }
+
+    uint16_t port = 0;
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> bytes{0};
+
+  private:
+    static bool readFully(int fd, unsigned char *buf, size_t len)
+    {
+        while(len > 0)
+        {
+            const ssize_t got = recv(fd, buf, len, 0);
+            if(got <= 0) return false;
+            buf += got;
+            len -= got;
+        }
+        return true;
+    }
+
+    void serve()
+    {
+        const int fd = accept(m_listenFd, nullptr, nullptr);
+        if(fd < 0) return;
+
+        std::vector<unsigned char> body(64*1024);
+        unsigned char header;
+
+        while(readFully(fd, &header, 1))
+        {
+            size_t remaining = 0;
+            unsigned char byte;
+            int shift = 0;
+            do
+            {
+                if(!readFully(fd, &byte, 1)) break;
+                remaining |= (size_t)(byte & 0x7F) << shift;
+                shift += 7;
+            } while(byte & 0x80);
+
+            if(remaining > body.size()) body.resize(remaining);
+            if(!readFully(fd, body.data(), remaining)) break;
+
+            if((header & 0xF0) == 0x10)
+            {
+                const unsigned char connack[4] = {0x20, 0x02, 0x00, 0x00};
+                send(fd, connack, sizeof(connack), MSG_NOSIGNAL);
+            }
+            else if((header & 0xF0) == 0x30)
+            {
+                messages++;
+                bytes += remaining;
+            }
+        }
+
+        close(fd);
+    }
+
+    int m_listenFd;
+    std::thread m_thread;
+};
+
+static uint64_t residentBytes()
+{
+    long pages = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if(fp)
+    {
+        if(fscanf(fp, "%*s %ld", &pages) != 1) pages = 0;
+        fclose(fp);
+    }
+    return (uint64_t)pages * sysconf(_SC_PAGESIZE);
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  -n <count>  Sensors (default %d)\n", DEFAULT_SENSORS);
+    printf("  -s <sec>    Supervision interval (default %d)\n", DEFAULT_SUPERVISION_SEC);
+    printf("  -r <count>  Frames per transmission (default %d)\n", DEFAULT_REPEATS);
+    printf("  -d <sec>    Simulated duration (default %d)\n", DEFAULT_DURATION_SEC);
+    printf("  -e <rate>   Open/close events per sensor per hour (default %.1f)\n", DEFAULT_EVENTS_PER_HOUR);
+    printf("  -A <frac>   Fraction of sensors tripped by an alarm storm (default 0)\n");
+    printf("  -T <sec>    When the storm starts (default half way)\n");
+    printf("  -W <sec>    How long the storm takes to spread (default 10)\n");
+    printf("  -b          Publish over MQTT to a local broker stand-in\n");
+    printf("  -v          Keep the decoder's console output\n");
+}
+
+int main(int argc, char **argv)
+{
+    int sensors = DEFAULT_SENSORS;
+    int supervisionSec = DEFAULT_SUPERVISION_SEC;
+    int repeats = DEFAULT_REPEATS;
+    int durationSec = DEFAULT_DURATION_SEC;
+    float eventsPerHour = DEFAULT_EVENTS_PER_HOUR;
+    float stormFraction = 0.0f;
+    int stormSec = -1;
+    int stormWindowSec = 10;
+    bool useBroker = false;
+    bool verbose = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "n:s:r:d:e:A:T:W:bvh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n': sensors = atoi(optarg); break;
+            case 's': supervisionSec = atoi(optarg); break;
+            case 'r': repeats = atoi(optarg); break;
+            case 'd': durationSec = atoi(optarg); break;
+            case 'e': eventsPerHour = atof(optarg); break;
+            case 'A': stormFraction = atof(optarg); break;
+            case 'T': stormSec = atoi(optarg); break;
+            case 'W': stormWindowSec = atoi(optarg); break;
+            case 'b': useBroker = true; break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+
+    if(sensors < 1 || supervisionSec < 1 || repeats < 1 || durationSec < 1 || stormWindowSec < 1)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if(stormSec < 0) stormSec = durationSec/2;
+
+    //
+    // Build the whole schedule up front so generation isn't part of the measurement.
+    //
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<injection_t> schedule;
+
+    auto transmit = [&](double timeSec, uint32_t serial, uint8_t status)
+    {
+        if(timeSec < 0.0 || timeSec >= durationSec) return;
+
+        const uint64_t start = (uint64_t)(timeSec*SAMPLE_RATE);
+        const uint64_t payload = SignalGenerator::buildFrame(serial, status);
+
+        for(int rr = 0; rr < repeats; ++rr)
+        {
+            schedule.push_back({start + rr*FRAME_SAMPLES, payload});
+        }
+    };
+
+    for(int ss = 0; ss < sensors; ++ss)
+    {
+        const uint32_t serial = SERIAL_BASE + ss;
+
+        // A third are motion detectors, which report with loop1 clear when idle
+        const bool motion = (ss % 3) == 0;
+        const uint8_t idle = motion ? 0x00 : STATUS_LOOP1;
+        const uint8_t tripped = motion ? STATUS_LOOP1 : (STATUS_LOOP1 | STATUS_LOOP2);
+
+        for(double tt = uniform(rng)*supervisionSec; tt < durationSec; tt += supervisionSec)
+        {
+            transmit(tt, serial, idle | STATUS_HEARTBEAT);
+        }
+
+        //
+        // Poisson open/close activity, each opening followed by a closing.
+        //
+        if(eventsPerHour > 0.0f)
+        {
+            std::exponential_distribution<double> gap(eventsPerHour/3600.0);
+            for(double tt = gap(rng); tt < durationSec; tt += gap(rng))
+            {
+                transmit(tt, serial, tripped);
+                transmit(tt + 5.0 + 55.0*uniform(rng), serial, idle);
+            }
+        }
+
+        if(uniform(rng) < stormFraction)
+        {
+            const double tt = stormSec + uniform(rng)*stormWindowSec;
+            transmit(tt, serial, tripped);
+            transmit(tt + STORM_HOLD_SEC, serial, idle);
+        }
+    }
+
+    std::sort(schedule.begin(), schedule.end());
+
+    //
+    // Decoder and output stage under test
+    //
+
+    SampleClock clock(SAMPLE_RATE);
+    clock.setAnchor(0, SampleClock::realtimeNowUs(), SampleClock::monotonicNowUs());
+
+    DigitalDecoder dDecoder;
+    dDecoder.setSampleClock(&clock);
+    dDecoder.setOutputEnabled(verbose);
+
+    CountingSink counter;
+    LocalBroker *broker = useBroker ? new LocalBroker() : nullptr;
+    MqttSink *mqtt = useBroker ? new MqttSink("127.0.0.1", broker->port, "", "", "loadGenerator", true) : nullptr;
+
+    if(mqtt) dDecoder.addSink(mqtt);
+    else dDecoder.addSink(&counter);
+
+    std::vector<uint32_t> latencyNs(schedule.size());
+    const uint64_t startRss = residentBytes();
+    const size_t memoryStride = std::max<size_t>(1, schedule.size()/MEMORY_SAMPLES);
+
+    printf("%10s %10s %10s %12s\n", "Frames", "Devices", "Sensors", "RSS(kB)");
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for(size_t ii = 0; ii < schedule.size(); ++ii)
+    {
+        const injection_t &frame = schedule[ii];
+
+        const auto before = std::chrono::steady_clock::now();
+        dDecoder.handlePayload(frame.payload, DigitalDecoder::isPayloadValid(frame.payload), frame.sampleIndex);
+        const auto after = std::chrono::steady_clock::now();
+
+        latencyNs[ii] = std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count();
+
+        if((ii + 1) % memoryStride == 0)
+        {
+            printf("%10zu %10zu %10zu %12llu\n", ii + 1, dDecoder.getDeviceCount(), dDecoder.getSensorCount(), (unsigned long long)(residentBytes()/1024));
+        }
+    }
+
+    const auto stop = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(stop - start).count();
+
+    //
+    // Let the broker drain before counting what it got.
+    //
+
+    const uint64_t dropped = mqtt ? mqtt->getDroppedCount() : 0;
+    delete mqtt;
+    if(broker) broker->finish();
+
+    std::sort(latencyNs.begin(), latencyNs.end());
+    auto percentile = [&](double pp){return latencyNs.empty() ? 0 : latencyNs[(size_t)(pp*(latencyNs.size() - 1))];};
+
+    printf("\n");
+    printf("Frames injected:   %zu over %d simulated seconds\n", schedule.size(), durationSec);
+    printf("Sustained rate:    %.0f frames/sec (%.1fx realtime)\n", schedule.size()/seconds, durationSec/seconds);
+    printf("Latency (ns):      p50 %u  p99 %u  p99.9 %u  max %u\n", percentile(0.5), percentile(0.99), percentile(0.999), percentile(1.0));
+    printf("deviceStateMap:    %zu entries\n", dDecoder.getDeviceCount());
+
+    // updateSensorState() has no caller, so this should stay 0 until it gets one
+    printf("sensorStatusMap:   %zu entries\n", dDecoder.getSensorCount());
+    printf("RSS growth:        %lld kB\n", (long long)(residentBytes() - startRss)/1024);
+
+    if(useBroker)
+    {
+        printf("Broker received:   %llu messages, %llu bytes (%llu dropped on a full queue)\n",
+            (unsigned long long)broker->messages, (unsigned long long)broker->bytes, (unsigned long long)dropped);
+        delete broker;
+    }
+    else
+    {
+        printf("Published:         %llu messages, %llu bytes\n", (unsigned long long)counter.messages, (unsigned long long)counter.bytes);
+    }
+
+    return 0;
+}
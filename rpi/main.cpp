@@ -1,20 +1,97 @@
 #include "digitalDecoder.h"
 #include "analogDecoder.h"
+#include "protocolRegistry.h"
+#include "iqRingBuffer.h"
+#include "burstArchive.h"
+#include "outputSink.h"
+#include "sampleClock.h"
 
 #include <rtl-sdr.h>
 
 #include <iostream>
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <unistd.h>
 #include <sys/time.h>
+#include <csignal>
+#include <memory>
+#include <vector>
 
-float magLut[0x10000];
+#define SAMPLE_RATE 1000000
 
+#define MQTT_HOST      "192.168.0.35"
+#define MQTT_PORT      (1883)
+#define MQTT_USER      "mqtt-alarm2"
+#define MQTT_PASSWORD  "honeywell54312!"
+#define MQTT_CLIENT_ID "HoneywellSecurity"
 
-int main()
+// Raw IQ kept around each anomaly (send SIGUSR1 to dump on demand)
+#define DUMP_PRE_SECONDS  (4.0f)
+#define DUMP_POST_SECONDS (1.0f)
+#define DUMP_DIR "/tmp"
+#define DUMP_MAX_COUNT (10)
+
+// Margins kept either side of each burst when archiving (-a)
+#define ARCHIVE_PRE_SECONDS  (0.05f)
+#define ARCHIVE_POST_SECONDS (0.05f)
+
+static IqRingBuffer *dumpRing = nullptr;
+static rtlsdr_dev_t *device = nullptr;
+
+struct RxContext
+{
+    AnalogDecoder *adec;
+    IqRingBuffer *ring;
+    SampleClock *clock;
+    BurstArchiveWriter *archive;
+};
+
+static void usage(const char *name)
+{
+    std::cout << "Usage: " << name << " [options]" << std::endl;
+    std::cout << "  -j <file>    Append events to a JSON-lines file" << std::endl;
+    std::cout << "  -u <socket>  Send events as datagrams to a Unix socket" << std::endl;
+    std::cout << "  -a <file>    Record every burst to a compact IQ archive" << std::endl;
+    std::cout << "  -D <dir>     Where anomaly IQ dumps go (default " << DUMP_DIR << ")" << std::endl;
+    std::cout << "  -N <count>   Most anomaly IQ dumps to keep, 0 for none (default " << DUMP_MAX_COUNT << ")" << std::endl;
+    std::cout << "  -m           Don't publish to MQTT" << std::endl;
+    std::cout << "  -q           Don't echo events to stdout" << std::endl;
+}
+
+int main(int argc, char **argv)
 {
     int gain = 0;
     
+    //
+    // Pick the event sinks
+    //
+    std::vector<std::unique_ptr<OutputSink>> sinks;
+    bool useMqtt = true;
+    bool useStdout = true;
+    const char *archivePath = nullptr;
+    const char *dumpDir = DUMP_DIR;
+    int maxDumps = DUMP_MAX_COUNT;
+    
+    int opt;
+    while((opt = getopt(argc, argv, "j:u:a:D:N:mqh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'j': sinks.emplace_back(new JsonLinesSink(optarg)); break;
+            case 'u': sinks.emplace_back(new DatagramSink(optarg)); break;
+            case 'a': archivePath = optarg; break;
+            case 'D': dumpDir = optarg; break;
+            case 'N': maxDumps = std::max(0, atoi(optarg)); break;
+            case 'm': useMqtt = false; break;
+            case 'q': useStdout = false; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+    
+    if(useStdout) sinks.emplace_back(new StdoutSink());
+    if(useMqtt) sinks.emplace_back(new MqttSink(MQTT_HOST, MQTT_PORT, MQTT_USER, MQTT_PASSWORD, MQTT_CLIENT_ID, true));
+    
     //
     // Open the device
     //
@@ -75,7 +152,7 @@ int main()
     //
     // Set the sample rate
     //
-   if(rtlsdr_set_sample_rate(dev, 1000000) < 0)
+   if(rtlsdr_set_sample_rate(dev, SAMPLE_RATE) < 0)
    // if(rtlsdr_set_sample_rate(dev, 250000) < 0)
     {
         std::cout << "Failed to set sample rate" << std::endl;
@@ -89,25 +166,46 @@ int main()
     //
     rtlsdr_reset_buffer(dev);
     
-    for(uint32_t ii = 0; ii < 0x10000; ++ii)
-    {
-        uint8_t real_i = ii & 0xFF;
-        uint8_t imag_i = ii >> 8;
-        
-        float real = (((float)real_i) - 127.4) * (1.0f/128.0f);
-        float imag = (((float)imag_i) - 127.4) * (1.0f/128.0f);
-        
-        float mag = std::sqrt(real*real + imag*imag);
-        magLut[ii] = mag;
-    }
-    
     //
     // Common Receive
     //
     AnalogDecoder aDecoder;
     DigitalDecoder dDecoder;
+    ProtocolRegistry protocols;
+    
+    dDecoder.registerProtocols(protocols);
+    
+    IqRingBuffer ring(SAMPLE_RATE, DUMP_PRE_SECONDS, DUMP_POST_SECONDS, dumpDir, maxDumps);
+    SampleClock clock(SAMPLE_RATE);
+    
+    dDecoder.setSampleClock(&clock);
+    
+    for(auto &sink : sinks)
+    {
+        dDecoder.addSink(sink.get());
+    }
+    
+    aDecoder.setCallback([&](char data, uint64_t sampleIndex, float margin){protocols.handleData(data, sampleIndex, margin);});
+    dDecoder.setAnomalyCallback([&](DigitalDecoder::Anomaly anomaly)
+    {
+        ring.trigger(anomaly == DigitalDecoder::ANOMALY_CRC_FAILURE ? IqRingBuffer::TRIGGER_CRC_FAILURE : IqRingBuffer::TRIGGER_SYNC_LOSS);
+    });
     
-    aDecoder.setCallback([&](char data){dDecoder.handleData(data);});
+    std::unique_ptr<BurstArchiveWriter> archive;
+    if(archivePath)
+    {
+        archive.reset(new BurstArchiveWriter(archivePath, SAMPLE_RATE, ARCHIVE_PRE_SECONDS, ARCHIVE_POST_SECONDS, ARCHIVE_ZLIB, &clock));
+    }
+    
+    dumpRing = &ring;
+    signal(SIGUSR1, [](int){dumpRing->requestDump();});
+    
+    // Stop streaming on Ctrl-C so the archive index gets written
+    device = dev;
+    signal(SIGINT, [](int){rtlsdr_cancel_async(device);});
+    signal(SIGTERM, [](int){rtlsdr_cancel_async(device);});
+    
+    RxContext rxContext = {&aDecoder, &ring, &clock, archive.get()};
     
     //
     // Async Receive
@@ -117,17 +215,18 @@ int main()
     
     auto cb = [](unsigned char *buf, uint32_t len, void *ctx)
     {
-        AnalogDecoder *adec = (AnalogDecoder *)ctx;
+        RxContext *rx = (RxContext *)ctx;
+        AnalogDecoder *adec = rx->adec;
         
-        int n_samples = len/2;
-        for(int i = 0; i < n_samples; ++i)
-        {
-            float mag = magLut[*((uint16_t*)(buf + i*2))];
-            adec->handleMagnitude(mag);
-        }
+        // The last sample of this buffer just arrived
+        rx->clock->anchor(adec->getSampleIndex() + len/2);
+        
+        rx->ring->push(buf, len);
+        if(rx->archive) rx->archive->push(buf, len);
+        adec->handleSamples(buf, len);
     };
     
-    const int err = rtlsdr_read_async(dev, cb, &aDecoder, 0, 0);
+    const int err = rtlsdr_read_async(dev, cb, &rxContext, 0, 0);
     std::cout << "Read Async returned " << err << std::endl;
     
 /*    
@@ -146,12 +245,7 @@ int main()
             return -1;
         }
         
-        int n_samples = n_read/2;
-        for(int i = 0; i < n_samples; ++i)
-        {
-            float mag = magLut[*((uint16_t*)(buffer + i*2))];
-            aDecoder.handleMagnitude(mag);
-        }
+        aDecoder.handleSamples(buffer, n_read);
     }
 */    
     //
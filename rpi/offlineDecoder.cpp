@@ -0,0 +1,353 @@
+#include "digitalDecoder.h"
+#include "analogDecoder.h"
+#include "protocolRegistry.h"
+#include "outputSink.h"
+#include "sampleClock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//
+// Decodes an 8-bit IQ capture (.cu8) on all cores. The file is cut into chunks,
+// each owning the frames whose sync word starts inside it. Every chunk gets its
+// own AnalogDecoder/ProtocolRegistry/DigitalDecoder and starts decoding early
+// enough for the adaptive threshold to settle, and runs on past its end by a
+// couple of frames so frames straddling the boundary complete. Soft combining
+// carries state from copy to copy, so the lead-in also reaches back to a quiet
+// stretch that closed every burst. The merged log matches a sequential decode
+// of the whole file (-V checks that).
+//
+
+#define SAMPLE_RATE (1000000)
+
+// Longest frame we frame, in raw samples; the Honeywell frame is the only one registered
+#define MAX_FRAME_SAMPLES (DigitalDecoder::frameSamples())
+
+// Extra lead-in beyond the threshold settling time, so the bit clock settles too
+#define WARMUP_MARGIN_SAMPLES (2*MAX_FRAME_SAMPLES)
+
+// Run-on past the chunk end; soft combining only reports a frame a little after it ends
+#define RUNON_SAMPLES (2*MAX_FRAME_SAMPLES)
+
+#define CHUNKS_PER_THREAD (4)
+
+// Samples handed to the AnalogDecoder per call, like one USB buffer
+#define BLOCK_SAMPLES (128*1024)
+
+// Samples mapped at a time, so a 32-bit build can decode captures bigger than its address space
+#define MAP_WINDOW_SAMPLES (256*BLOCK_SAMPLES)
+
+struct frameRecord_t
+{
+    uint64_t sampleIndex;
+    uint64_t payload;
+
+    bool operator<(const frameRecord_t &other) const
+    {
+        return (sampleIndex != other.sampleIndex) ? (sampleIndex < other.sampleIndex) : (payload < other.payload);
+    }
+    bool operator==(const frameRecord_t &other) const
+    {
+        return sampleIndex == other.sampleIndex && payload == other.payload;
+    }
+};
+
+struct chunk_t
+{
+    uint64_t ownStart;
+    uint64_t ownEnd;
+    std::vector<frameRecord_t> frames;
+    bool failed;
+};
+
+//
+// Hand samples [from, to) of the capture to the decoder, mapping a window at a time.
+//
+static bool feedSamples(int fd, AnalogDecoder &aDecoder, uint64_t from, uint64_t to)
+{
+    const uint64_t pageMask = sysconf(_SC_PAGESIZE) - 1;
+
+    for(uint64_t ws = from; ws < to; ws += MAP_WINDOW_SAMPLES)
+    {
+        const uint64_t we = std::min(to, ws + MAP_WINDOW_SAMPLES);
+        const uint64_t offset = (2*ws) & ~pageMask;
+        const size_t length = 2*we - offset;
+
+        void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, offset);
+        if(map == MAP_FAILED)
+        {
+            perror("mmap");
+            return false;
+        }
+        madvise(map, length, MADV_SEQUENTIAL);
+
+        const unsigned char *iq = (const unsigned char *)map + (2*ws - offset);
+        for(uint64_t ss = ws; ss < we; ss += BLOCK_SAMPLES)
+        {
+            aDecoder.handleSamples(iq + 2*(ss - ws), 2*std::min<uint64_t>(BLOCK_SAMPLES, we - ss));
+        }
+
+        munmap(map, length);
+    }
+
+    return true;
+}
+
+//
+// Decode [ownStart, ownEnd) of the capture, keeping only frames that start in it.
+//
+static void decodeChunk(int fd, uint64_t totalSamples, chunk_t &chunk, uint64_t warmup)
+{
+    const uint64_t start = (chunk.ownStart > warmup) ? (chunk.ownStart - warmup) : 0;
+    const uint64_t end = std::min(totalSamples, chunk.ownEnd + RUNON_SAMPLES);
+
+    AnalogDecoder aDecoder;
+    DigitalDecoder dDecoder;
+    ProtocolRegistry protocols;
+
+    dDecoder.registerProtocols(protocols);
+    dDecoder.setOutputEnabled(false);
+
+    aDecoder.setSampleIndex(start);
+    aDecoder.setCallback([&](char data, uint64_t sampleIndex, float margin){protocols.handleData(data, sampleIndex, margin);});
+    dDecoder.setPayloadCallback([&](uint64_t payload, bool valid, uint64_t sampleIndex)
+    {
+        if(valid && sampleIndex >= chunk.ownStart && sampleIndex < chunk.ownEnd)
+        {
+            chunk.frames.push_back({sampleIndex, payload});
+        }
+    });
+
+    if(!feedSamples(fd, aDecoder, start, chunk.ownStart))
+    {
+        chunk.failed = true;
+        return;
+    }
+
+    //
+    // Busy right up to the chunk: try again from further back. The quiet stretch has
+    // to begin after the threshold settled, or the sequential decode may not see it.
+    //
+    if(start > 0 && protocols.getLastQuietStart() < start + AnalogDecoder::settlingSamples())
+    {
+        decodeChunk(fd, totalSamples, chunk, 2*warmup);
+        return;
+    }
+
+    chunk.failed = !feedSamples(fd, aDecoder, chunk.ownStart, end);
+}
+
+static bool decodeFile(int fd, uint64_t totalSamples, unsigned int threads, uint64_t chunkSamples, std::vector<frameRecord_t> &frames)
+{
+    //
+    // Chunks much shorter than the warmup would spend most of their time re-decoding it.
+    //
+    const uint64_t warmup = AnalogDecoder::settlingSamples() + WARMUP_MARGIN_SAMPLES;
+    if(chunkSamples == 0)
+    {
+        chunkSamples = (totalSamples + threads*CHUNKS_PER_THREAD - 1)/(threads*CHUNKS_PER_THREAD);
+        chunkSamples = std::max(chunkSamples, 8*warmup);
+    }
+
+    std::vector<chunk_t> chunks;
+    for(uint64_t ss = 0; ss < totalSamples; ss += chunkSamples)
+    {
+        chunks.push_back({ss, std::min(totalSamples, ss + chunkSamples), {}, false});
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+
+    for(unsigned int tt = 0; tt < std::min<size_t>(threads, chunks.size()); ++tt)
+    {
+        workers.emplace_back([&]()
+        {
+            size_t ii;
+            while((ii = next++) < chunks.size())
+            {
+                decodeChunk(fd, totalSamples, chunks[ii], warmup);
+            }
+        });
+    }
+
+    for(auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    //
+    // Chunks are already in order; sort/unique anyway so the log is canonical.
+    //
+    for(auto &chunk : chunks)
+    {
+        if(chunk.failed) return false;
+        frames.insert(frames.end(), chunk.frames.begin(), chunk.frames.end());
+    }
+
+    std::sort(frames.begin(), frames.end());
+    frames.erase(std::unique(frames.begin(), frames.end()), frames.end());
+
+    return true;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] <capture.cu8>\n", name);
+    printf("  -t <threads>  Worker threads (default: all cores)\n");
+    printf("  -r <rate>     Capture sample rate (default %d)\n", SAMPLE_RATE);
+    printf("  -c <seconds>  Chunk length (default: sized from the file and thread count)\n");
+    printf("  -T <epoch>    Wall time of the first sample, in seconds (default 0)\n");
+    printf("  -o <file>     Write the frame log here instead of stdout\n");
+    printf("  -j <file>     Also replay the frames through the state tracker into a JSON-lines file\n");
+    printf("  -V            Decode sequentially too and check the results match\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t sampleRate = SAMPLE_RATE;
+    double startTime = 0.0;
+    double chunkSeconds = 0.0;
+    const char *outPath = nullptr;
+    const char *jsonPath = nullptr;
+    bool verify = false;
+
+    int opt;
+    while((opt = getopt(argc, argv, "t:r:c:T:o:j:Vh")) != -1)
+    {
+        switch(opt)
+        {
+            case 't': threads = std::max(1, atoi(optarg)); break;
+            case 'r': sampleRate = atoi(optarg); break;
+            case 'c': chunkSeconds = atof(optarg); break;
+            case 'T': startTime = atof(optarg); break;
+            case 'o': outPath = optarg; break;
+            case 'j': jsonPath = optarg; break;
+            case 'V': verify = true; break;
+            default: usage(argv[0]); return -1;
+        }
+    }
+
+    if(optind != argc - 1 || sampleRate == 0)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    //
+    // Each chunk maps its own part of the capture; the page cache does the I/O for all the workers.
+    //
+    const int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0)
+    {
+        perror(argv[optind]);
+        return -1;
+    }
+
+    const uint64_t totalSamples = st.st_size/2;
+    if(totalSamples == 0)
+    {
+        fprintf(stderr, "%s is empty\n", argv[optind]);
+        return -1;
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    const uint64_t chunkSamples = (chunkSeconds > 0.0) ? std::max<uint64_t>(MAX_FRAME_SAMPLES, chunkSeconds*sampleRate) : 0;
+    std::vector<frameRecord_t> frames;
+    if(!decodeFile(fd, totalSamples, threads, chunkSamples, frames)) return -1;
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    fprintf(stderr, "Decoded %.1f s of capture in %.2f s on %u threads (%.0fx realtime), %zu frames\n",
+        (double)totalSamples/sampleRate, seconds, threads, totalSamples/(double)sampleRate/seconds, frames.size());
+
+    if(verify)
+    {
+        chunk_t whole = {0, totalSamples, {}, false};
+        decodeChunk(fd, totalSamples, whole, 0);
+        if(whole.failed) return -1;
+        std::sort(whole.frames.begin(), whole.frames.end());
+
+        //
+        // Not deduplicated: the decoder reports each frame once, so a repeat here is a bug.
+        //
+        bool duplicated = false;
+        for(size_t ii = 1; ii < whole.frames.size(); ++ii)
+        {
+            if(whole.frames[ii] == whole.frames[ii - 1])
+            {
+                fprintf(stderr, "  reported twice: %llu %016llX\n",
+                    (unsigned long long)whole.frames[ii].sampleIndex, (unsigned long long)whole.frames[ii].payload);
+                duplicated = true;
+            }
+        }
+
+        const bool matches = (whole.frames == frames);
+        fprintf(stderr, "Sequential decode: %zu frames, %s\n", whole.frames.size(), matches ? "identical" : "MISMATCH");
+        if(duplicated) return 1;
+        if(!matches)
+        {
+            std::vector<frameRecord_t> diff;
+            std::set_symmetric_difference(frames.begin(), frames.end(), whole.frames.begin(), whole.frames.end(), std::back_inserter(diff));
+            for(const auto &frame : diff)
+            {
+                const bool parallelOnly = std::binary_search(frames.begin(), frames.end(), frame);
+                fprintf(stderr, "  %s only: %llu %016llX\n", parallelOnly ? "parallel" : "sequential",
+                    (unsigned long long)frame.sampleIndex, (unsigned long long)frame.payload);
+            }
+            return 1;
+        }
+    }
+
+    //
+    // Frame log: sample index, wall time, payload, serial, status
+    //
+    SampleClock clock(sampleRate);
+    clock.setAnchor(0, (int64_t)(startTime*1e6), 0);
+
+    FILE *out = outPath ? fopen(outPath, "w") : stdout;
+    if(!out)
+    {
+        perror(outPath);
+        return -1;
+    }
+
+    for(const auto &frame : frames)
+    {
+        DigitalDecoder::writeFrameLog(out, frame.payload, frame.sampleIndex, clock);
+    }
+
+    if(outPath) fclose(out);
+
+    //
+    // State tracking is inherently sequential, but it only sees the frames.
+    //
+    if(jsonPath)
+    {
+        JsonLinesSink sink(jsonPath);
+        DigitalDecoder dDecoder;
+
+        dDecoder.setOutputEnabled(false);
+        dDecoder.setSampleClock(&clock);
+        dDecoder.addSink(&sink);
+
+        for(const auto &frame : frames)
+        {
+            dDecoder.handlePayload(frame.payload, true, frame.sampleIndex);
+        }
+    }
+
+    close(fd);
+    return 0;
+}
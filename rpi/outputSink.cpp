@@ -0,0 +1,456 @@
+#include "outputSink.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// Don't hammer an unreachable broker
+#define MQTT_RECONNECT_SEC (5)
+#define MQTT_TIMEOUT_MS    (1000)
+
+// Ping after this long without sending; the broker drops us after 1.5 times it
+#define MQTT_KEEPALIVE_SEC (60)
+
+// How often the writer thread looks at the connection when there's nothing to send
+#define MQTT_POLL_MS (500)
+
+static const char RECORD_START[] = "{\"topic\": \"";
+static const char RECORD_MIDDLE[] = "\", \"payload\": ";
+static const char RECORD_END[] = "}\n";
+
+//
+// The JSON-lines and datagram sinks share one record layout, gathered without copying.
+//
+static int buildRecord(struct iovec *iov, const char *topic, size_t topicLen, const char *payload, size_t payloadLen)
+{
+    iov[0].iov_base = (void *)RECORD_START;
+    iov[0].iov_len = sizeof(RECORD_START) - 1;
+    iov[1].iov_base = (void *)topic;
+    iov[1].iov_len = topicLen;
+    iov[2].iov_base = (void *)RECORD_MIDDLE;
+    iov[2].iov_len = sizeof(RECORD_MIDDLE) - 1;
+    iov[3].iov_base = (void *)payload;
+    iov[3].iov_len = payloadLen;
+    iov[4].iov_base = (void *)RECORD_END;
+    iov[4].iov_len = sizeof(RECORD_END) - 1;
+    return 5;
+}
+
+void StdoutSink::publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen)
+{
+    fwrite(topic, 1, topicLen, stdout);
+    fputc(' ', stdout);
+    fwrite(payload, 1, payloadLen, stdout);
+    fputc('\n', stdout);
+
+    // Events should reach a pipe or the journal as they happen, not when the buffer fills
+    fflush(stdout);
+}
+
+JsonLinesSink::JsonLinesSink(const std::string &path)
+{
+    m_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(m_fd < 0)
+    {
+        std::cout << "Failed to open " << path << " for event log" << std::endl;
+    }
+}
+
+JsonLinesSink::~JsonLinesSink()
+{
+    if(m_fd >= 0) close(m_fd);
+}
+
+void JsonLinesSink::publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen)
+{
+    if(m_fd < 0) return;
+
+    // O_APPEND + a single writev keeps lines whole even with several writers
+    struct iovec iov[5];
+    if(writev(m_fd, iov, buildRecord(iov, topic, topicLen, payload, payloadLen)) < 0)
+    {
+        perror("event log write");
+    }
+}
+
+DatagramSink::DatagramSink(const std::string &socketPath) :
+    m_socketPath(socketPath)
+{
+    m_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(m_fd < 0)
+    {
+        perror("datagram socket");
+    }
+}
+
+DatagramSink::~DatagramSink()
+{
+    if(m_fd >= 0) close(m_fd);
+}
+
+void DatagramSink::publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen)
+{
+    if(m_fd < 0) return;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, m_socketPath.c_str(), sizeof(addr.sun_path) - 1);
+
+    struct iovec iov[5];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &addr;
+    msg.msg_namelen = sizeof(addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = buildRecord(iov, topic, topicLen, payload, payloadLen);
+
+    // Nobody listening or a full queue just loses the event; never block here
+    sendmsg(m_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+MqttSink::MqttSink(const std::string &host, uint16_t port, const std::string &user,
+                   const std::string &password, const std::string &clientId, bool retain) :
+    m_host(host),
+    m_port(port),
+    m_user(user),
+    m_password(password),
+    m_clientId(clientId),
+    m_retain(retain),
+    m_queue(QUEUE_PACKETS)
+{
+    // Before receiving starts, so the first events don't wait on the handshake
+    connect();
+
+    m_writer = std::thread(&MqttSink::writerLoop, this);
+}
+
+MqttSink::~MqttSink()
+{
+    m_running = false;
+    m_wake.notify_one();
+    m_writer.join();
+
+    disconnect();
+}
+
+static size_t putString(unsigned char *out, const std::string &str)
+{
+    out[0] = str.size() >> 8;
+    out[1] = str.size() & 0xFF;
+    memcpy(out + 2, str.data(), str.size());
+    return 2 + str.size();
+}
+
+static size_t putRemainingLength(unsigned char *out, size_t len)
+{
+    size_t used = 0;
+    do
+    {
+        unsigned char byte = len % 128;
+        len /= 128;
+        if(len > 0) byte |= 0x80;
+        out[used++] = byte;
+    } while(len > 0);
+
+    return used;
+}
+
+bool MqttSink::connect()
+{
+    time_t now = time(nullptr);
+    if(now - m_lastConnectFailure < MQTT_RECONNECT_SEC) return false;
+
+    // Assume failure until the CONNACK is in
+    m_lastConnectFailure = now;
+
+    //
+    // Open the TCP connection, with a timeout so a dead broker can't stall the writer for long.
+    //
+
+    char port[8];
+    snprintf(port, sizeof(port), "%u", m_port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *addrs = nullptr;
+    if(getaddrinfo(m_host.c_str(), port, &hints, &addrs) != 0 || !addrs)
+    {
+        std::cout << "Failed to resolve MQTT broker " << m_host << std::endl;
+        return false;
+    }
+
+    m_fd = socket(addrs->ai_family, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(m_fd < 0)
+    {
+        freeaddrinfo(addrs);
+        return false;
+    }
+
+    int rc = ::connect(m_fd, addrs->ai_addr, addrs->ai_addrlen);
+    freeaddrinfo(addrs);
+
+    if(rc < 0 && errno == EINPROGRESS)
+    {
+        struct pollfd pfd = {m_fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t errLen = sizeof(err);
+
+        if(poll(&pfd, 1, MQTT_TIMEOUT_MS) == 1 && getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &errLen) == 0 && err == 0)
+        {
+            rc = 0;
+        }
+    }
+
+    if(rc < 0)
+    {
+        std::cout << "Failed to connect to MQTT broker " << m_host << ":" << m_port << std::endl;
+        disconnect();
+        return false;
+    }
+
+    fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_NONBLOCK);
+
+    struct timeval timeout = {MQTT_TIMEOUT_MS/1000, (MQTT_TIMEOUT_MS%1000)*1000};
+    setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Let TCP notice a vanished broker too, in case our pings go unanswered silently
+    int keepalive = 1;
+    int idle = MQTT_KEEPALIVE_SEC;
+    int interval = MQTT_KEEPALIVE_SEC/4;
+    int count = 3;
+    setsockopt(m_fd, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+    setsockopt(m_fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(m_fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(m_fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count));
+
+    //
+    // CONNECT: clean session, keepalive, optional credentials.
+    //
+
+    unsigned char body[PACKET_MAX];
+    size_t bodyLen = 0;
+
+    if(10 + 6 + m_clientId.size() + m_user.size() + m_password.size() > PACKET_MAX - 5)
+    {
+        disconnect();
+        return false;
+    }
+
+    bodyLen += putString(body + bodyLen, "MQTT");
+    body[bodyLen++] = 4;
+    body[bodyLen++] = 0x02 | (m_user.empty() ? 0 : 0x80) | (m_password.empty() ? 0 : 0x40);
+    body[bodyLen++] = MQTT_KEEPALIVE_SEC >> 8;
+    body[bodyLen++] = MQTT_KEEPALIVE_SEC & 0xFF;
+    bodyLen += putString(body + bodyLen, m_clientId);
+    if(!m_user.empty()) bodyLen += putString(body + bodyLen, m_user);
+    if(!m_password.empty()) bodyLen += putString(body + bodyLen, m_password);
+
+    unsigned char packet[PACKET_MAX];
+    size_t packetLen = 0;
+    packet[packetLen++] = 0x10;
+    packetLen += putRemainingLength(packet + packetLen, bodyLen);
+    memcpy(packet + packetLen, body, bodyLen);
+    packetLen += bodyLen;
+
+    unsigned char connack[4];
+    if(send(m_fd, packet, packetLen, MSG_NOSIGNAL) != (ssize_t)packetLen ||
+       recv(m_fd, connack, sizeof(connack), MSG_WAITALL) != sizeof(connack) ||
+       connack[0] != 0x20 || connack[3] != 0)
+    {
+        std::cout << "MQTT broker " << m_host << " refused connection" << std::endl;
+        disconnect();
+        return false;
+    }
+
+    std::cout << "Connected to MQTT broker " << m_host << ":" << m_port << std::endl;
+
+    m_connected = true;
+    m_lastConnectFailure = 0;
+    m_lastSend = now;
+    m_pingSent = 0;
+    return true;
+}
+
+void MqttSink::disconnect()
+{
+    if(m_fd >= 0) close(m_fd);
+    m_fd = -1;
+    m_connected = false;
+}
+
+bool MqttSink::checkConnection()
+{
+    if(m_fd < 0) return false;
+
+    //
+    // We never expect anything but PINGRESP, so any readable data just proves the
+    // broker is there. A close or reset shows up here before we waste a packet on it.
+    //
+
+    for(;;)
+    {
+        struct pollfd pfd = {m_fd, POLLIN, 0};
+        if(poll(&pfd, 1, 0) != 1)
+        {
+            // Nothing to read; an unanswered ping means the connection is half open
+            if(m_pingSent == 0 || time(nullptr) - m_pingSent < MQTT_KEEPALIVE_SEC/2) return true;
+            break;
+        }
+
+        if(pfd.revents & (POLLHUP | POLLERR)) break;
+
+        unsigned char scratch[64];
+        const ssize_t got = recv(m_fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+        if(got == 0) break;
+        if(got < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            break;
+        }
+
+        m_pingSent = 0;
+    }
+
+    std::cout << "Lost connection to MQTT broker " << m_host << std::endl;
+    disconnect();
+    return false;
+}
+
+bool MqttSink::sendPacket(const unsigned char *data, size_t len)
+{
+    //
+    // Once more after reconnecting, so a connection that died since we last
+    // looked costs a reconnect rather than the packet.
+    //
+
+    for(int attempt = 0; attempt < 2; ++attempt)
+    {
+        if(!checkConnection() && !connect()) return false;
+
+        if(send(m_fd, data, len, MSG_NOSIGNAL) == (ssize_t)len)
+        {
+            m_lastSend = time(nullptr);
+            return true;
+        }
+
+        std::cout << "Lost connection to MQTT broker " << m_host << std::endl;
+        disconnect();
+    }
+
+    return false;
+}
+
+void MqttSink::writerLoop()
+{
+    bool running = true;
+
+    while(running)
+    {
+        // Stay connected, so an event doesn't wait for the handshake
+        if(!checkConnection()) connect();
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait_for(lock, std::chrono::milliseconds(MQTT_POLL_MS), [this]()
+            {
+                return !m_running || m_queueTail.load(std::memory_order_relaxed) != m_queueHead.load(std::memory_order_acquire);
+            });
+        }
+
+        // Take one last pass on shutdown so queued packets go out if they can
+        running = m_running;
+
+        uint32_t tail = m_queueTail.load(std::memory_order_relaxed);
+        while(tail != m_queueHead.load(std::memory_order_acquire))
+        {
+            const queuedPacket_t &packet = m_queue[tail % QUEUE_PACKETS];
+
+            // Broker unreachable; leave it queued and try again later
+            if(!sendPacket(packet.data, packet.len)) break;
+
+            tail++;
+            m_queueTail.store(tail, std::memory_order_release);
+        }
+
+        //
+        // Keep an idle connection alive, and find out if it has died before an event needs it.
+        //
+
+        if(checkConnection() && m_pingSent == 0 && time(nullptr) - m_lastSend >= MQTT_KEEPALIVE_SEC/2)
+        {
+            const unsigned char pingreq[2] = {0xC0, 0x00};
+            if(send(m_fd, pingreq, sizeof(pingreq), MSG_NOSIGNAL) == sizeof(pingreq))
+            {
+                m_lastSend = m_pingSent = time(nullptr);
+            }
+        }
+    }
+
+    const uint32_t lost = m_queueHead.load(std::memory_order_acquire) - m_queueTail.load(std::memory_order_relaxed);
+    if(lost > 0)
+    {
+        std::cout << "Discarding " << lost << " MQTT messages that couldn't be sent" << std::endl;
+    }
+}
+
+void MqttSink::publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen)
+{
+    const uint32_t head = m_queueHead.load(std::memory_order_relaxed);
+    const uint32_t tail = m_queueTail.load(std::memory_order_acquire);
+
+    if(5 + 2 + topicLen + payloadLen > PACKET_MAX)
+    {
+        std::cout << "MQTT message for " << std::string(topic, topicLen) << " is too long, dropping it" << std::endl;
+        return;
+    }
+
+    if(head - tail >= QUEUE_PACKETS)
+    {
+        // Never wait for the writer here; this is the receive path
+        if(m_droppedRun == 0) std::cout << "MQTT queue is full, dropping messages" << std::endl;
+        m_droppedRun++;
+        m_dropped++;
+        return;
+    }
+
+    if(m_droppedRun > 0)
+    {
+        std::cout << "MQTT queue has room again (dropped " << m_droppedRun << ")" << std::endl;
+        m_droppedRun = 0;
+    }
+
+    //
+    // PUBLISH, QoS 0: fixed header, topic, then the payload.
+    //
+
+    queuedPacket_t &packet = m_queue[head % QUEUE_PACKETS];
+    size_t len = 0;
+    packet.data[len++] = 0x30 | (m_retain ? 0x01 : 0x00);
+    len += putRemainingLength(packet.data + len, 2 + topicLen + payloadLen);
+    packet.data[len++] = topicLen >> 8;
+    packet.data[len++] = topicLen & 0xFF;
+    memcpy(packet.data + len, topic, topicLen);
+    len += topicLen;
+    memcpy(packet.data + len, payload, payloadLen);
+    len += payloadLen;
+    packet.len = len;
+
+    m_queueHead.store(head + 1, std::memory_order_release);
+    m_wake.notify_one();
+}
@@ -0,0 +1,135 @@
+#ifndef __OUTPUT_SINK_H__
+#define __OUTPUT_SINK_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Somewhere to deliver serialized events. The decoder hands every sink the same
+// topic and JSON payload; sinks must not hold on to either after publish() returns.
+//
+class OutputSink
+{
+  public:
+    virtual ~OutputSink() = default;
+
+    virtual void publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen) = 0;
+};
+
+//
+// "topic payload" lines on stdout, interleaved with the rest of the console output.
+//
+class StdoutSink : public OutputSink
+{
+  public:
+    void publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen) override;
+};
+
+//
+// One {"topic": ..., "payload": ...} object per line, appended to a file.
+//
+class JsonLinesSink : public OutputSink
+{
+  public:
+    JsonLinesSink(const std::string &path);
+    ~JsonLinesSink();
+
+    void publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen) override;
+
+  private:
+    int m_fd;
+};
+
+//
+// Same record as JsonLinesSink, one per datagram, to a local AF_UNIX socket.
+// Datagrams are dropped if nobody is listening.
+//
+class DatagramSink : public OutputSink
+{
+  public:
+    DatagramSink(const std::string &socketPath);
+    ~DatagramSink();
+
+    void publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen) override;
+
+  private:
+    int m_fd;
+    std::string m_socketPath;
+};
+
+//
+// Minimal MQTT 3.1.1 publisher (QoS 0) over a persistent TCP connection, so we
+// don't fork mosquitto_pub per message.
+//
+// publish() copies the packet into a fixed queue and returns; it must always be
+// called from the same thread. A writer thread does the sending: it checks the
+// connection before each packet, keeps it alive with PINGREQs, and reconnects and
+// resends rather than losing a packet. Packets wait in the queue while the broker
+// is unreachable. publish() runs on the receive path, so it never waits: if the
+// queue is full the packet is dropped and counted.
+//
+class MqttSink : public OutputSink
+{
+  public:
+    MqttSink(const std::string &host, uint16_t port, const std::string &user,
+             const std::string &password, const std::string &clientId, bool retain);
+    ~MqttSink();
+
+    void publish(const char *topic, size_t topicLen, const char *payload, size_t payloadLen) override;
+
+    // Messages lost to a full queue
+    uint64_t getDroppedCount() const {return m_dropped;};
+
+  private:
+    static const size_t PACKET_MAX = 1024;
+
+    // Room for an alarm storm across a large site while the broker catches up
+    static const uint32_t QUEUE_PACKETS = 1024;
+
+    struct queuedPacket_t
+    {
+        size_t len;
+        unsigned char data[PACKET_MAX];
+    };
+
+    bool connect();
+    void disconnect();
+    bool checkConnection();
+    bool sendPacket(const unsigned char *data, size_t len);
+    void writerLoop();
+
+    std::string m_host;
+    uint16_t m_port;
+    std::string m_user;
+    std::string m_password;
+    std::string m_clientId;
+    bool m_retain;
+
+    // Only the writer thread touches the connection, once constructed
+    int m_fd = -1;
+    std::atomic<bool> m_connected{false};
+    time_t m_lastConnectFailure = 0;
+    time_t m_lastSend = 0;
+    time_t m_pingSent = 0;
+
+    // Single producer (publish), single consumer (writer thread)
+    std::vector<queuedPacket_t> m_queue;
+    std::atomic<uint32_t> m_queueHead{0};
+    std::atomic<uint32_t> m_queueTail{0};
+    uint64_t m_dropped = 0;
+    uint64_t m_droppedRun = 0;
+
+    std::atomic<bool> m_running{true};
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::thread m_writer;
+};
+
+#endif
@@ -0,0 +1,466 @@
+#include "protocolRegistry.h"
+
+#include <algorithm>
+#include <iostream>
+
+void ProtocolRegistry::add(const protocol_t &protocol)
+{
+    if(protocol.frameBits == 0 || protocol.frameBits > MAX_FRAME_BITS ||
+       protocol.preambleBits == 0 || protocol.preambleBits > protocol.frameBits ||
+       protocol.samplesPerChip < 2)
+    {
+        std::cout << "Ignoring protocol " << protocol.name << " with unsupported framing" << std::endl;
+        return;
+    }
+
+    framer_t framer;
+    framer.protocol = protocol;
+    framer.frameMask = (protocol.frameBits == 64) ? ~0ull : ((1ull << protocol.frameBits) - 1);
+    framer.preambleMask = (protocol.preambleBits == 64) ? ~0ull : ((1ull << protocol.preambleBits) - 1);
+
+    //
+    // Join an existing channel if the timing matches, so the demodulation is shared.
+    //
+
+    const unsigned int quietChips = QUIET_FRAMES*2*protocol.frameBits;
+
+    for(auto &channel : m_channels)
+    {
+        if(channel.samplesPerChip == protocol.samplesPerChip)
+        {
+            channel.framers.push_back(framer);
+            channel.quietChips = std::max(channel.quietChips, quietChips);
+            return;
+        }
+    }
+
+    channel_t channel;
+    channel.samplesPerChip = protocol.samplesPerChip;
+    channel.quietChips = quietChips;
+    channel.framers.push_back(framer);
+    m_channels.push_back(channel);
+
+    //
+    // Margin history for the soft decode: twice the longest frame, as a power of two.
+    //
+    size_t history = 1;
+    while(history < 2*MAX_FRAME_BITS*2*protocol.samplesPerChip) history <<= 1;
+    if(history > m_margins.size()) m_margins.assign(history, 0.0f);
+}
+
+void ProtocolRegistry::noteFrame(framer_t &framer, uint64_t start, uint64_t frameSamples, uint64_t frame, bool valid)
+{
+    const uint64_t sourceMask = framer.protocol.sourceMask;
+
+    //
+    // Copies of one transmission follow each other within about a frame's length,
+    // but so can another transmitter's. Once the burst's frame is known, a copy
+    // from another source (or a good copy of another frame) starts a new burst;
+    // until then a good copy is checked against the combined guess.
+    //
+    const bool timedOut = !framer.burstOpen || start > framer.burstLastStart + 2*frameSamples;
+    bool newBurst = timedOut;
+
+    if(!newBurst && framer.burstDecoded)
+    {
+        newBurst = valid ? (frame != framer.burstFrame) : (((frame ^ framer.burstFrame) & sourceMask) != 0);
+    }
+    else if(!newBurst && valid && framer.burstCopies > 0)
+    {
+        newBurst = ((frame ^ combinedFrame(framer)) & sourceMask) != 0;
+    }
+
+    if(newBurst)
+    {
+        // A noisy copy of the frame just decoded can split off too; remember it so it isn't recovered twice
+        framer.burstFollowsDecoded = !timedOut && framer.burstDecoded;
+
+        std::fill(framer.combinedSoft, framer.combinedSoft + MAX_FRAME_BITS, 0.0f);
+        framer.burstCopies = 0;
+        framer.burstOpen = true;
+        framer.burstDecoded = false;
+    }
+
+    if(valid)
+    {
+        framer.burstDecoded = true;
+        framer.burstFrame = frame;
+    }
+
+    framer.burstLastStart = std::max(framer.burstLastStart, start);
+}
+
+uint64_t ProtocolRegistry::getLastQuietStart() const
+{
+    uint64_t quietStart = UINT64_MAX;
+    for(const auto &channel : m_channels)
+    {
+        quietStart = std::min(quietStart, channel.quietStart);
+    }
+    return m_channels.empty() ? 0 : quietStart;
+}
+
+uint64_t ProtocolRegistry::combinedFrame(const framer_t &framer) const
+{
+    uint64_t frame = 0;
+    for(unsigned int ii = 0; ii < framer.protocol.frameBits; ++ii)
+    {
+        frame = (frame << 1) | ((framer.combinedSoft[ii] > 0.0f) ? 1 : 0);
+    }
+    return frame;
+}
+
+float ProtocolRegistry::chipEnergy(uint64_t base, float offset, unsigned int samplesPerChip) const
+{
+    // Most of the chip, clear of the edges
+    const int halfWidth = (int)samplesPerChip/2 - 1;
+    const uint64_t middle = base + (uint64_t)(offset + 0.5f);
+    const uint64_t mask = m_margins.size() - 1;
+
+    float sum = 0.0f;
+    for(int ii = -halfWidth; ii <= halfWidth; ++ii)
+    {
+        sum += m_margins[(middle + ii) & mask];
+    }
+    return sum;
+}
+
+void ProtocolRegistry::queueSoftFrame(channel_t &channel, framer_t &framer)
+{
+    const protocol_t &protocol = framer.protocol;
+
+    //
+    // The preamble was just seen, so the grid from its first to its last bit is good.
+    //
+    const uint64_t first = channel.bitCount - protocol.preambleBits;
+    const uint64_t firstSecondHalf = channel.bitSlice[first % MAX_FRAME_BITS];
+    const uint64_t lastSecondHalf = channel.bitSlice[(channel.bitCount - 1) % MAX_FRAME_BITS];
+    const float nominal = 2.0f*channel.samplesPerChip;
+    const float slicesPerBit = (protocol.preambleBits > 1) ? (float)(lastSecondHalf - firstSecondHalf)/(protocol.preambleBits - 1) : nominal;
+
+    // A preamble made of slipped chips isn't worth re-slicing
+    if(slicesPerBit < 0.75f*nominal || slicesPerBit > 1.25f*nominal) return;
+
+    const uint64_t firstSlice = firstSecondHalf - (uint64_t)(slicesPerBit/2 + 0.5f);
+
+    softFrame_t soft;
+    soft.start = channel.bitSampleIndex[first % MAX_FRAME_BITS];
+    soft.frameSamples = (channel.bitSampleIndex[(channel.bitCount - 1) % MAX_FRAME_BITS] - soft.start)*protocol.frameBits/protocol.preambleBits;
+    soft.firstSlice = firstSlice;
+    soft.slicesPerBit = slicesPerBit;
+
+    // A couple of bits late, so the hard decode of the same copy comes first
+    soft.readyAt = firstSlice + (uint64_t)((protocol.frameBits + 2)*slicesPerBit);
+
+    //
+    // A preamble inside a frame already queued is either that frame's data or a sign
+    // the two are on different grids; whichever, summing both would blur the copies.
+    // The hard decode still tries it, as the frame around it may fail.
+    //
+    for(unsigned int ii = 0; ii < framer.pendingCount; ++ii)
+    {
+        const softFrame_t &earlier = framer.pending[ii];
+        if(soft.start > earlier.start && soft.start < earlier.start + earlier.frameSamples) return;
+    }
+
+    if(framer.pendingCount == MAX_PENDING)
+    {
+        std::copy(framer.pending + 1, framer.pending + MAX_PENDING, framer.pending);
+        framer.pendingCount--;
+    }
+
+    framer.pending[framer.pendingCount++] = soft;
+    channel.softReadyAt = std::min(channel.softReadyAt, soft.readyAt);
+}
+
+void ProtocolRegistry::handleSoftFrames(channel_t &channel)
+{
+    channel.softReadyAt = UINT64_MAX;
+
+    for(auto &framer : channel.framers)
+    {
+        unsigned int kept = 0;
+        for(unsigned int ii = 0; ii < framer.pendingCount; ++ii)
+        {
+            const softFrame_t &soft = framer.pending[ii];
+
+            if(soft.readyAt < m_sliceCount)
+            {
+                combineRepeat(channel, framer, soft);
+            }
+            else
+            {
+                channel.softReadyAt = std::min(channel.softReadyAt, soft.readyAt);
+                framer.pending[kept++] = soft;
+            }
+        }
+        framer.pendingCount = kept;
+    }
+}
+
+void ProtocolRegistry::combineRepeat(channel_t &channel, framer_t &framer, const softFrame_t &soft)
+{
+    const protocol_t &protocol = framer.protocol;
+
+    // Fell out of the margin history (only if sliced samples stopped being counted)
+    if(soft.firstSlice + m_margins.size() < m_sliceCount + channel.samplesPerChip) return;
+
+    //
+    // Manchester: a 1 is low then high, so second chip minus first is positive.
+    //
+    float copySoft[MAX_FRAME_BITS];
+    uint64_t copyFrame = 0;
+    for(unsigned int ii = 0; ii < protocol.frameBits; ++ii)
+    {
+        // Offsets from the first chip, as a float can't hold a sliced sample count exactly
+        const float firstChip = ii*soft.slicesPerBit;
+        const float secondChip = firstChip + soft.slicesPerBit/2;
+
+        copySoft[ii] = chipEnergy(soft.firstSlice, secondChip, channel.samplesPerChip) -
+                       chipEnergy(soft.firstSlice, firstChip, channel.samplesPerChip);
+        copyFrame = (copyFrame << 1) | ((copySoft[ii] > 0.0f) ? 1 : 0);
+    }
+
+    // This copy on its own decides which burst it joins
+    noteFrame(framer, soft.start, soft.frameSamples, copyFrame, false);
+
+    for(unsigned int ii = 0; ii < protocol.frameBits; ++ii)
+    {
+        framer.combinedSoft[ii] += copySoft[ii];
+    }
+    framer.burstCopies++;
+
+    if(framer.burstDecoded) return;
+
+    // The preamble is what lined the copies up, so it is known exactly
+    const unsigned int preambleShift = protocol.frameBits - protocol.preambleBits;
+    const uint64_t frame = (combinedFrame(framer) & ~(framer.preambleMask << preambleShift)) | (protocol.preamble << preambleShift);
+
+    if(protocol.checksum(frame))
+    {
+        const bool repeat = framer.burstFollowsDecoded && frame == framer.burstFrame;
+
+        framer.burstDecoded = true;
+        framer.burstFrame = frame;
+        if(repeat) return;
+
+        framer.recoveredStart = soft.start;
+        framer.recoveredFrame = frame;
+        m_recoveredCount++;
+
+        if(protocol.onFrame) protocol.onFrame(frame, true, soft.start);
+    }
+}
+
+void ProtocolRegistry::handleBit(channel_t &channel, bool value, uint64_t sampleIndex, uint64_t slice)
+{
+    channel.bits <<= 1;
+    channel.bits |= (value ? 1 : 0);
+
+    channel.bitSampleIndex[channel.bitCount % MAX_FRAME_BITS] = sampleIndex;
+    channel.bitSlice[channel.bitCount % MAX_FRAME_BITS] = slice;
+    channel.bitCount++;
+
+    for(auto &framer : channel.framers)
+    {
+        const protocol_t &protocol = framer.protocol;
+
+        if(framer.bitsSinceFrame < MAX_FRAME_BITS) framer.bitsSinceFrame++;
+
+        //
+        // Any preamble could start a frame, even one in the middle of another
+        // frame's data. Which it was is only known once the earlier frame is checked.
+        //
+
+        if((channel.bits & framer.preambleMask) == protocol.preamble && framer.bitsSinceFrame >= protocol.preambleBits)
+        {
+            if(m_combining && protocol.checksum) queueSoftFrame(channel, framer);
+
+            if(framer.openCount == MAX_OPEN_FRAMES)
+            {
+                std::copy(framer.openPreambles + 1, framer.openPreambles + MAX_OPEN_FRAMES, framer.openPreambles);
+                framer.openCount--;
+            }
+            framer.openPreambles[framer.openCount++] = channel.bitCount;
+        }
+
+        //
+        // A whole frame behind the oldest open preamble
+        //
+
+        if(framer.openCount == 0 || channel.bitCount - framer.openPreambles[0] < protocol.frameBits - protocol.preambleBits) continue;
+
+        const uint64_t frame = channel.bits & framer.frameMask;
+        const uint64_t start = channel.bitSampleIndex[(channel.bitCount - protocol.frameBits) % MAX_FRAME_BITS];
+        const bool valid = protocol.checksum ? protocol.checksum(frame) : true;
+
+        const uint64_t frameEnd = framer.openPreambles[0];
+        std::copy(framer.openPreambles + 1, framer.openPreambles + framer.openCount, framer.openPreambles);
+        framer.openCount--;
+
+        if(valid)
+        {
+            // Later preambles were this frame's data, and so are any soft copies queued on them
+            framer.openCount = 0;
+            framer.bitsSinceFrame = 0;
+
+            unsigned int kept = 0;
+            for(unsigned int ii = 0; ii < framer.pendingCount; ++ii)
+            {
+                if(framer.pending[ii].start <= start) framer.pending[kept++] = framer.pending[ii];
+            }
+            framer.pendingCount = kept;
+        }
+        else if(framer.openCount > 0)
+        {
+            //
+            // A new preamble arrived part way through a frame that then failed:
+            // report what came before it and carry on with the new frame.
+            //
+            const uint64_t nextStart = framer.openPreambles[0] - protocol.preambleBits;
+            const unsigned int partialBits = (nextStart > frameEnd) ? nextStart - frameEnd : 0;
+            if(protocol.onSyncLoss) protocol.onSyncLoss((channel.bits >> (channel.bitCount - nextStart)) & ((1ull << partialBits) - 1));
+            continue;
+        }
+
+        if(m_combining && protocol.checksum)
+        {
+            noteFrame(framer, start, sampleIndex - start, frame, valid);
+
+            // Soft decoding got there first (the hard decode slipped a chip or two)
+            if(valid && start == framer.recoveredStart && frame == framer.recoveredFrame) continue;
+        }
+
+        if(protocol.onFrame) protocol.onFrame(frame, valid, start);
+    }
+}
+
+void ProtocolRegistry::handleIdle(channel_t &channel)
+{
+    //
+    // The carrier has gone. Give up on any open frame now rather than when the next
+    // preamble arrives, so the framing state no longer depends on what came before.
+    //
+
+    for(auto &framer : channel.framers)
+    {
+        const protocol_t &protocol = framer.protocol;
+
+        const unsigned int partialBits = (framer.openCount > 0) ? channel.bitCount - framer.openPreambles[0] : 0;
+        if(partialBits > 0 && protocol.onSyncLoss) protocol.onSyncLoss(channel.bits & ((1ull << partialBits) - 1));
+
+        framer.bitsSinceFrame = 0;
+        framer.openCount = 0;
+    }
+
+    channel.bits = 0;
+}
+
+void ProtocolRegistry::handleQuiet(channel_t &channel)
+{
+    //
+    // Long enough that the next copy would start a new burst anyway. Close them now,
+    // so the combining state no longer depends on what came before either.
+    //
+
+    for(auto &framer : channel.framers)
+    {
+        std::fill(framer.combinedSoft, framer.combinedSoft + MAX_FRAME_BITS, 0.0f);
+        framer.burstCopies = 0;
+        framer.burstOpen = false;
+        framer.burstDecoded = false;
+        framer.burstFrame = 0;
+        framer.burstFollowsDecoded = false;
+        framer.burstLastStart = 0;
+        framer.recoveredStart = UINT64_MAX;
+        framer.recoveredFrame = 0;
+    }
+
+    channel.quietStart = channel.lastHighIndex;
+}
+
+void ProtocolRegistry::decodeChip(channel_t &channel, bool value, uint64_t sampleIndex, uint64_t slice)
+{
+    if(value)
+    {
+        channel.idleChips = 0;
+        channel.lastHighIndex = sampleIndex;
+    }
+    else
+    {
+        channel.idleChips++;
+        if(channel.idleChips == IDLE_CHIPS) handleIdle(channel);
+        if(channel.idleChips == channel.quietChips) handleQuiet(channel);
+    }
+
+    //
+    // A bit is only emitted once the chip after it is seen, so the previous chip
+    // (sampled mid-chip at lastChipIndex) was the bit's second half. Back up
+    // one and a half chips from there to find where the bit began.
+    //
+    const uint64_t bitStart = channel.lastChipIndex - 3*(sampleIndex - channel.lastChipIndex)/2;
+    channel.lastChipIndex = sampleIndex;
+
+    // Where that second half was sampled; it follows an edge, so unlike the first
+    // half (which may follow silence) its position doesn't depend on history
+    const uint64_t bitSlice = channel.lastChipSlice;
+    channel.lastChipSlice = slice;
+
+    switch(channel.manchesterState)
+    {
+        case LOW_PHASE_A:
+        {
+            channel.manchesterState = value ? HIGH_PHASE_B : LOW_PHASE_A;
+            break;
+        }
+        case LOW_PHASE_B:
+        {
+            handleBit(channel, false, bitStart, bitSlice);
+            channel.manchesterState = value ? HIGH_PHASE_A : LOW_PHASE_A;
+            break;
+        }
+        case HIGH_PHASE_A:
+        {
+            channel.manchesterState = value ? HIGH_PHASE_A : LOW_PHASE_B;
+            break;
+        }
+        case HIGH_PHASE_B:
+        {
+            handleBit(channel, true, bitStart, bitSlice);
+            channel.manchesterState = value ? HIGH_PHASE_A : LOW_PHASE_A;
+            break;
+        }
+    }
+}
+
+void ProtocolRegistry::handleData(char data, uint64_t sampleIndex, float margin)
+{
+    if(data != 0 && data != 1) return;
+
+    if(m_channels.empty()) return;
+
+    const bool thisSample = (data == 1);
+    const uint64_t slice = m_sliceCount++;
+    m_margins[slice & (m_margins.size() - 1)] = margin;
+
+    for(auto &channel : m_channels)
+    {
+        if(thisSample == channel.lastSample)
+        {
+            channel.samplesSinceEdge++;
+
+            if((channel.samplesSinceEdge % channel.samplesPerChip) == (channel.samplesPerChip/2))
+            {
+                // This sample is a new chip
+                decodeChip(channel, thisSample, sampleIndex, slice);
+            }
+        }
+        else
+        {
+            channel.samplesSinceEdge = 1;
+        }
+        channel.lastSample = thisSample;
+
+        if(m_sliceCount > channel.softReadyAt) handleSoftFrames(channel);
+    }
+}
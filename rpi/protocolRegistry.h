@@ -0,0 +1,171 @@
+#ifndef __PROTOCOL_REGISTRY_H__
+#define __PROTOCOL_REGISTRY_H__
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+//
+// Describes one Manchester-coded OOK frame format. The frame is the last frameBits
+// bits received, preamble included, right-aligned in a uint64_t.
+//
+struct protocol_t
+{
+    const char *name;
+
+    unsigned int samplesPerChip;    // Sliced samples per half bit
+    unsigned int frameBits;         // Up to 64, preamble included
+    unsigned int preambleBits;
+    uint64_t preamble;
+
+    bool (*checksum)(uint64_t frame);
+
+    // Bits naming the transmitter (its serial, say); repeats are only soft combined
+    // while these agree. 0 combines on timing alone.
+    uint64_t sourceMask = 0;
+
+    // Called with the frame, whether its checksum passed, and the sample index of the preamble
+    std::function<void(uint64_t, bool, uint64_t)> onFrame;
+
+    // Optional: a frame was cut short by a new preamble or by the carrier going (bits so far are passed)
+    std::function<void(uint64_t)> onSyncLoss;
+};
+
+//
+// Runs every registered protocol over the one sliced stream from AnalogDecoder.
+// Protocols that share a chip length share a single clock recovery, Manchester
+// decoder and shift register; each bit is then checked against all of their
+// preambles, so another protocol at the same timing costs a compare per bit.
+//
+// Every preamble is also re-sliced from the threshold margins AnalogDecoder
+// passes along: each chip's margins are summed on the bit grid the preamble
+// sets, giving a soft value per bit that a dropped or extra chip can't shift.
+// Soft values of the copies in a burst are summed, and while no copy has passed
+// its checksum the combined frame is tried as well. Copies whose source bits
+// disagree with the burst's are kept apart, so back-to-back transmitters don't mix.
+//
+class ProtocolRegistry
+{
+  public:
+    ProtocolRegistry() = default;
+
+    void add(const protocol_t &protocol);
+    void handleData(char data, uint64_t sampleIndex, float margin = 0.0f);
+
+    // Combining failed repeats is on by default
+    void setCombining(bool enabled) {m_combining = enabled;};
+
+    // Frames recovered by combining, on top of those decoded on their own
+    uint32_t getRecoveredCount() const {return m_recoveredCount;};
+
+    // Where the latest stretch quiet for long enough to close every burst began (its
+    // last high chip); whatever came before, decoding from there on is the same. 0 if none yet.
+    uint64_t getLastQuietStart() const;
+
+  private:
+    static const unsigned int MAX_FRAME_BITS = 64;
+
+    // Preambles awaiting their soft decode, per protocol
+    static const unsigned int MAX_PENDING = 4;
+
+    // Preambles that can be open at once; the sync word may recur in a frame's data
+    static const unsigned int MAX_OPEN_FRAMES = 4;
+
+    // Low chips in a row after which no frame can still be open (Manchester allows 2)
+    static const unsigned int IDLE_CHIPS = 8;
+
+    // Low frames in a row after which no burst can still be open (copies time out after 2)
+    static const unsigned int QUIET_FRAMES = 2;
+
+    enum ManchesterState
+    {
+        LOW_PHASE_A,
+        LOW_PHASE_B,
+        HIGH_PHASE_A,
+        HIGH_PHASE_B
+    };
+
+    struct softFrame_t
+    {
+        uint64_t start;             // Raw sample index, as for onFrame
+        uint64_t frameSamples;      // Raw samples the whole frame spans
+        uint64_t firstSlice;        // Sliced sample at the middle of the first chip
+        float slicesPerBit;
+        uint64_t readyAt;           // Sliced sample after which the whole frame is in
+    };
+
+    struct framer_t
+    {
+        protocol_t protocol;
+        uint64_t frameMask;
+        uint64_t preambleMask;
+        unsigned int bitsSinceFrame = 0;
+
+        // Bit counts at which preambles that may each start a frame ended, oldest first
+        uint64_t openPreambles[MAX_OPEN_FRAMES];
+        unsigned int openCount = 0;
+
+        softFrame_t pending[MAX_PENDING];
+        unsigned int pendingCount = 0;
+
+        // Soft values summed over the copies seen in the current burst
+        float combinedSoft[MAX_FRAME_BITS] = {};
+        unsigned int burstCopies = 0;
+        bool burstOpen = false;
+        bool burstDecoded = false;
+        uint64_t burstFrame = 0;        // Once decoded
+        bool burstFollowsDecoded = false;
+        uint64_t burstLastStart = 0;
+
+        // So the hard decode of a copy that was already recovered isn't reported twice
+        uint64_t recoveredStart = UINT64_MAX;
+        uint64_t recoveredFrame = 0;
+    };
+
+    struct channel_t
+    {
+        unsigned int samplesPerChip;
+        unsigned int samplesSinceEdge = 0;
+        bool lastSample = false;
+
+        ManchesterState manchesterState = LOW_PHASE_A;
+        uint64_t lastChipIndex = 0;
+        unsigned int idleChips = 0;
+        uint64_t lastChipSlice = 0;
+
+        unsigned int quietChips = 0;        // Low chips that close every burst
+        uint64_t lastHighIndex = 0;
+        uint64_t quietStart = 0;
+
+        uint64_t bits = 0;
+        uint64_t bitSampleIndex[MAX_FRAME_BITS] = {};
+        uint64_t bitSlice[MAX_FRAME_BITS] = {};
+        uint64_t bitCount = 0;
+
+        std::vector<framer_t> framers;
+        uint64_t softReadyAt = UINT64_MAX;
+    };
+
+    void decodeChip(channel_t &channel, bool value, uint64_t sampleIndex, uint64_t slice);
+    void handleBit(channel_t &channel, bool value, uint64_t sampleIndex, uint64_t slice);
+    void handleIdle(channel_t &channel);
+    void handleQuiet(channel_t &channel);
+
+    void queueSoftFrame(channel_t &channel, framer_t &framer);
+    void handleSoftFrames(channel_t &channel);
+    void combineRepeat(channel_t &channel, framer_t &framer, const softFrame_t &soft);
+    void noteFrame(framer_t &framer, uint64_t start, uint64_t frameSamples, uint64_t frame, bool valid);
+    uint64_t combinedFrame(const framer_t &framer) const;
+    float chipEnergy(uint64_t base, float offset, unsigned int samplesPerChip) const;
+
+    std::vector<channel_t> m_channels;
+
+    // Threshold margin of recent sliced samples, indexed by sliced sample count
+    std::vector<float> m_margins;
+    uint64_t m_sliceCount = 0;
+
+    bool m_combining = true;
+    uint32_t m_recoveredCount = 0;
+};
+
+#endif
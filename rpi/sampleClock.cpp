@@ -0,0 +1,53 @@
+#include "sampleClock.h"
+
+#include <ctime>
+
+static int64_t readClockUs(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (int64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+int64_t SampleClock::realtimeNowUs()
+{
+    return readClockUs(CLOCK_REALTIME);
+}
+
+int64_t SampleClock::monotonicNowUs()
+{
+    return readClockUs(CLOCK_MONOTONIC);
+}
+
+void SampleClock::anchor(uint64_t sampleIndex)
+{
+    setAnchor(sampleIndex, realtimeNowUs(), monotonicNowUs());
+    m_live = true;
+}
+
+void SampleClock::setAnchor(uint64_t sampleIndex, int64_t realtimeUs, int64_t monotonicUs)
+{
+    m_anchorSample = sampleIndex;
+    m_anchorRealtimeUs = realtimeUs;
+    m_anchorMonotonicUs = monotonicUs;
+    m_live = false;
+}
+
+int64_t SampleClock::samplesToUs(uint64_t sampleIndex) const
+{
+    //
+    // Signed offset from the anchor; frames are usually a little before it.
+    //
+    const int64_t delta = (int64_t)(sampleIndex - m_anchorSample);
+    return delta*1000000/(int64_t)m_sampleRate;
+}
+
+int64_t SampleClock::toRealtimeUs(uint64_t sampleIndex) const
+{
+    return m_anchorRealtimeUs + samplesToUs(sampleIndex);
+}
+
+int64_t SampleClock::toMonotonicUs(uint64_t sampleIndex) const
+{
+    return m_anchorMonotonicUs + samplesToUs(sampleIndex);
+}
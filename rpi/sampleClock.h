@@ -0,0 +1,43 @@
+#ifndef __SAMPLE_CLOCK_H__
+#define __SAMPLE_CLOCK_H__
+
+#include <stdint.h>
+
+//
+// Maps absolute sample indices to wall time. The receive path anchors it once per
+// USB buffer, so stamping a frame is arithmetic rather than a clock syscall, and the
+// stamp reflects when the frame was on the air rather than when we got to it.
+//
+class SampleClock
+{
+  public:
+    SampleClock(uint32_t sampleRate) : m_sampleRate(sampleRate) {};
+
+    // The sample just before sampleIndex arrived now
+    void anchor(uint64_t sampleIndex);
+
+    // For replaying captures, where "now" is whenever the capture started
+    void setAnchor(uint64_t sampleIndex, int64_t realtimeUs, int64_t monotonicUs);
+
+    int64_t toRealtimeUs(uint64_t sampleIndex) const;
+    int64_t toMonotonicUs(uint64_t sampleIndex) const;
+
+    uint32_t getSampleRate() const {return m_sampleRate;};
+
+    // Anchored from the system clocks by anchor(), so monotonic times can be compared with now
+    bool isLive() const {return m_live;};
+
+    static int64_t realtimeNowUs();
+    static int64_t monotonicNowUs();
+
+  private:
+    int64_t samplesToUs(uint64_t sampleIndex) const;
+
+    uint32_t m_sampleRate;
+    uint64_t m_anchorSample = 0;
+    int64_t m_anchorRealtimeUs = 0;
+    int64_t m_anchorMonotonicUs = 0;
+    bool m_live = false;
+};
+
+#endif
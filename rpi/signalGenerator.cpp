@@ -0,0 +1,117 @@
+#include "signalGenerator.h"
+#include "digitalDecoder.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define FRAME_BITS 64
+
+SignalGenerator::SignalGenerator(const config_t &config, uint32_t seed) :
+    m_config(config),
+    m_rng(seed),
+    m_noise(0.0f, 1.0f),
+    m_uniform(0.0f, 1.0f)
+{
+    //
+    // SNR is carrier power (A^2) over complex noise power (2*sigma^2).
+    //
+    m_noiseSigma = config.amplitude / std::sqrt(2.0f * std::pow(10.0f, config.snrDb/10.0f));
+
+    m_samplesPerChip = config.chipSeconds * config.sampleRate * (1.0 + config.clockDriftPpm*1e-6);
+
+    m_carrierPhase = 2.0*M_PI*m_uniform(m_rng);
+}
+
+uint64_t SignalGenerator::buildFrame(uint32_t serial, uint8_t status, uint8_t type)
+{
+    const uint64_t data = ((uint64_t)(type & 0xF) << 28) | ((uint64_t)(serial & 0xFFFFF) << 8) | status;
+    const uint64_t crc = DigitalDecoder::crcRemainder(data << 16, DigitalDecoder::CRC_POLYNOMIAL);
+
+    return DigitalDecoder::SYNC_PATTERN | (data << 16) | crc;
+}
+
+void SignalGenerator::addBurst(std::vector<unsigned char> &iq, uint64_t frame, int repeats, uint32_t gapChips)
+{
+    for(int rr = 0; rr < repeats; ++rr)
+    {
+        //
+        // Manchester: a one is sent low-high, a zero high-low.
+        //
+        for(int bit = FRAME_BITS - 1; bit >= 0; --bit)
+        {
+            const bool value = frame & (1ull << bit);
+            addChip(iq, !value);
+            addChip(iq, value);
+        }
+    }
+
+    for(uint32_t ii = 0; ii < gapChips; ++ii)
+    {
+        addChip(iq, false);
+    }
+}
+
+void SignalGenerator::addSilence(std::vector<unsigned char> &iq, uint32_t samples)
+{
+    for(uint32_t ii = 0; ii < samples; ++ii)
+    {
+        addSample(iq, false);
+    }
+}
+
+void SignalGenerator::addChip(std::vector<unsigned char> &iq, bool on)
+{
+    //
+    // Carry the fractional sample over so clock drift accumulates across the burst.
+    //
+    m_chipPhase += m_samplesPerChip;
+
+    while(m_chipPhase >= 1.0)
+    {
+        addSample(iq, on);
+        m_chipPhase -= 1.0;
+    }
+}
+
+void SignalGenerator::addSample(std::vector<unsigned char> &iq, bool on)
+{
+    float real = m_noiseSigma * m_noise(m_rng);
+    float imag = m_noiseSigma * m_noise(m_rng);
+
+    if(on)
+    {
+        real += m_config.amplitude * std::cos(m_carrierPhase);
+        imag += m_config.amplitude * std::sin(m_carrierPhase);
+    }
+
+    m_carrierPhase += 2.0*M_PI*m_config.freqOffsetHz / m_config.sampleRate;
+    m_carrierPhase = std::fmod(m_carrierPhase, 2.0*M_PI);
+
+    //
+    // Randomly keyed CW interferer elsewhere in the passband.
+    //
+    if(m_interfererRemaining == 0 && m_config.interfererDuty > 0.0f)
+    {
+        const float meanSamples = m_config.interfererChips * m_samplesPerChip;
+        if(m_uniform(m_rng) < m_config.interfererDuty / (meanSamples * (1.0f - m_config.interfererDuty) + 1.0f))
+        {
+            m_interfererRemaining = (uint32_t)(meanSamples * 2.0f * m_uniform(m_rng)) + 1;
+        }
+    }
+
+    if(m_interfererRemaining > 0)
+    {
+        real += m_config.interfererAmplitude * std::cos(m_interfererPhase);
+        imag += m_config.interfererAmplitude * std::sin(m_interfererPhase);
+        m_interfererRemaining--;
+    }
+
+    m_interfererPhase += 2.0*M_PI*m_config.interfererOffsetHz / m_config.sampleRate;
+    m_interfererPhase = std::fmod(m_interfererPhase, 2.0*M_PI);
+
+    //
+    // Quantize the way the RTL2832 does, around 127.4.
+    //
+    iq.push_back((unsigned char)std::min(255.0f, std::max(0.0f, std::round(real*128.0f + 127.4f))));
+    iq.push_back((unsigned char)std::min(255.0f, std::max(0.0f, std::round(imag*128.0f + 127.4f))));
+}
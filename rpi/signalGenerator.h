@@ -0,0 +1,54 @@
+#ifndef __SIGNAL_GENERATOR_H__
+#define __SIGNAL_GENERATOR_H__
+
+#include <stdint.h>
+#include <random>
+#include <vector>
+
+//
+// Builds synthetic Honeywell 345MHz transmissions as 8-bit IQ, in the same
+// format librtlsdr delivers, so the decoder chain can be exercised without a radio.
+//
+class SignalGenerator
+{
+  public:
+    struct config_t
+    {
+        uint32_t sampleRate = 1000000;
+        float chipSeconds = 136e-6f;        // Half a Manchester bit
+        float amplitude = 0.5f;             // Carrier amplitude, 1.0 is full scale
+        float snrDb = 30.0f;                // Carrier power over total noise power
+        float freqOffsetHz = 0.0f;
+        float clockDriftPpm = 0.0f;         // Transmitter bit clock error
+        float interfererDuty = 0.0f;        // Fraction of time an interferer is keyed
+        float interfererAmplitude = 0.0f;
+        float interfererOffsetHz = 50000.0f;
+        uint32_t interfererChips = 20;      // Mean interferer burst length
+    };
+
+    SignalGenerator(const config_t &config, uint32_t seed = 1);
+
+    static uint64_t buildFrame(uint32_t serial, uint8_t status, uint8_t type = 0x8);
+
+    // Append a burst of back-to-back copies of a frame, then some silence
+    void addBurst(std::vector<unsigned char> &iq, uint64_t frame, int repeats, uint32_t gapChips = 40);
+    void addSilence(std::vector<unsigned char> &iq, uint32_t samples);
+
+  private:
+    void addChip(std::vector<unsigned char> &iq, bool on);
+    void addSample(std::vector<unsigned char> &iq, bool on);
+
+    config_t m_config;
+    std::mt19937 m_rng;
+    std::normal_distribution<float> m_noise;
+    std::uniform_real_distribution<float> m_uniform;
+
+    float m_noiseSigma;
+    double m_samplesPerChip;
+    double m_chipPhase = 0.0;
+    double m_carrierPhase = 0.0;
+    double m_interfererPhase = 0.0;
+    uint32_t m_interfererRemaining = 0;
+};
+
+#endif